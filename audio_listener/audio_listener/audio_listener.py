@@ -3,9 +3,11 @@ import atexit
 import numpy as np
 import pyaudio
 import rclpy
+from rclpy.duration import Duration
 from rclpy.node import Node
 from rclpy.qos import qos_profile_sensor_data
 from std_msgs.msg import Int16MultiArray, MultiArrayDimension
+from whisper_idl.msg import StampedAudio
 
 
 class AudioListenerNode(Node):
@@ -18,6 +20,7 @@ class AudioListenerNode(Node):
                 ("channels", 1),
                 ("frames_per_buffer", 1000),
                 ("rate", 16000),
+                ("stamped", False),
             ],
         )
 
@@ -28,6 +31,10 @@ class AudioListenerNode(Node):
             self.get_parameter("frames_per_buffer").get_parameter_value().integer_value
         )
         self.rate_ = self.get_parameter("rate").get_parameter_value().integer_value
+        self.stamped_ = (
+            self.get_parameter("stamped").get_parameter_value().bool_value
+        )
+        self.sequence_ = 0
 
         self.pyaudio_ = pyaudio.PyAudio()
         self.stream_ = self.pyaudio_.open(
@@ -39,7 +46,9 @@ class AudioListenerNode(Node):
         )
 
         self.audio_publisher_ = self.create_publisher(
-            Int16MultiArray, "~/audio", qos_profile=qos_profile_sensor_data
+            StampedAudio if self.stamped_ else Int16MultiArray,
+            "~/audio",
+            qos_profile=qos_profile_sensor_data,
         )
 
         self.audio_publisher_timer_ = self.create_timer(
@@ -52,12 +61,35 @@ class AudioListenerNode(Node):
     def audio_publisher_timer_callback_(self) -> None:
         audio = self.stream_.read(self.frames_per_buffer_)
         audio = np.frombuffer(audio, dtype=np.int16)
+        if self.stamped_:
+            self.publish_stamped_(audio)
+            return
         audio_msg = Int16MultiArray()
         audio_msg.data = audio.tolist()
         audio_msg.layout.data_offset = 0
         audio_msg.layout.dim.append(
             MultiArrayDimension(label="audio", size=self.frames_per_buffer_, stride=1)
         )
+        if self.channels_ > 1:
+            # Interleaved channels, see whisper_server's audio.channels parameter
+            audio_msg.layout.dim.append(
+                MultiArrayDimension(
+                    label="channels", size=self.channels_, stride=self.channels_
+                )
+            )
+        self.audio_publisher_.publish(audio_msg)
+
+    def publish_stamped_(self, audio: np.ndarray) -> None:
+        # The read returns once the last frame was captured, stamp the first one
+        duration_ns = int(1e9 * self.frames_per_buffer_ / self.rate_)
+        stamp = self.get_clock().now() - Duration(nanoseconds=duration_ns)
+        audio_msg = StampedAudio()
+        audio_msg.stamp = stamp.to_msg()
+        audio_msg.sequence = self.sequence_
+        audio_msg.sample_rate = self.rate_
+        audio_msg.channels = self.channels_
+        audio_msg.data = audio.tolist()
+        self.sequence_ += 1
         self.audio_publisher_.publish(audio_msg)
 
     def cleanup_(self):
@@ -0,0 +1,83 @@
+import os
+
+from ament_index_python import get_package_share_directory
+from launch import LaunchDescription
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+
+from launch.actions import DeclareLaunchArgument
+from launch.substitutions import LaunchConfiguration
+
+def generate_launch_description() -> LaunchDescription:
+    # Runs the pipeline on a file, pipe or synthetic audio instead of a microphone
+    args = [
+        DeclareLaunchArgument('active', default_value="true",
+                              description='Start with whisper node active'),
+        DeclareLaunchArgument('source', default_value="synthetic",
+                              description='Audio source: file, pipe or synthetic'),
+        DeclareLaunchArgument('path', default_value="",
+                              description='File or named pipe to read audio from'),
+        DeclareLaunchArgument('pace', default_value="1.0",
+                              description='Playback speed relative to real time'),
+    ]
+
+    ld = LaunchDescription()
+
+    whisper_config = os.path.join(
+        get_package_share_directory("whisper_server"), "config", "whisper.yaml"
+    )
+    audio_source_config = os.path.join(
+        get_package_share_directory("whisper_server"), "config", "audio_source.yaml"
+    )
+
+    # Intra-process communication hands audio messages over without a copy
+    container = ComposableNodeContainer(
+            name='whisper_container',
+            package='rclcpp_components',
+            namespace='',
+            executable='component_container_mt',
+            output={
+                    'stdout': 'screen',
+                    'stderr': 'screen',
+                },
+            emulate_tty=True,
+            composable_node_descriptions=[
+                # Audio source
+                ComposableNode(
+                    package='whisper_server',
+                    plugin='whisper::AudioSource',
+                    name='audio_source',
+                    namespace="whisper",
+                    parameters=[audio_source_config, {
+                        'source': LaunchConfiguration('source'),
+                        'path': LaunchConfiguration('path'),
+                        'pace': LaunchConfiguration('pace'),
+                    }],
+                    extra_arguments=[{'use_intra_process_comms': True}],
+                ),
+                # Whisper
+                ComposableNode(
+                    package='whisper_server',
+                    plugin='whisper::Inference',
+                    name='inference',
+                    namespace="whisper",
+                    parameters=[whisper_config, {
+                        'active': LaunchConfiguration('active'),
+                        'audio_type': 'stamped',
+                    }],
+                    remappings=[("audio", "/whisper/audio_source/audio")],
+                    extra_arguments=[{'use_intra_process_comms': True}],
+                ),
+                # Transcript manager
+                ComposableNode(
+                    package='transcript_manager',
+                    plugin='whisper::TranscriptManager',
+                    name='transcript_manager',
+                    namespace="whisper",
+                ),
+            ],
+        )
+    for arg in args:
+        ld.add_action(arg) # ARGUMENTS MUST GO FIRST!
+    ld.add_action(container)
+    return ld
@@ -0,0 +1,63 @@
+#ifndef WHISPER_NODES__AUDIO_SOURCE_HPP_
+#define WHISPER_NODES__AUDIO_SOURCE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rclcpp/rclcpp.hpp"
+#include "std_msgs/msg/int16_multi_array.hpp"
+#include "whisper.h"
+
+#include "whisper_util/audio_codec.hpp"
+#include "whisper_util/audio_sources.hpp"
+#include "whisper_util/chrono_utils.hpp"
+
+#include "whisper_idl/msg/audio_chunk.hpp"
+#include "whisper_idl/msg/compressed_audio.hpp"
+#include "whisper_idl/msg/stamped_audio.hpp"
+
+namespace whisper {
+
+/**
+ * @brief Publishes audio from a file, a pipe or a synthetic generator, so the pipeline runs
+ * without sound hardware.  Composed into the same container as the inference node, messages are
+ * handed over intra-process without a copy.
+ */
+class AudioSource : public rclcpp::Node {
+public:
+  AudioSource(const rclcpp::NodeOptions& options);
+  ~AudioSource();
+
+protected:
+  // parameters
+  void declare_parameters_();
+  std::unique_ptr<AudioSourceBackend> create_backend_();
+
+  // Reads and publishes chunks until the source is done or the node is destroyed
+  void run_();
+  void publish_(std::vector<std::int16_t> &&data, std::chrono::system_clock::time_point stamp);
+
+  rclcpp::Publisher<whisper_idl::msg::StampedAudio>::SharedPtr stamped_publisher_;
+  rclcpp::Publisher<whisper_idl::msg::AudioChunk>::SharedPtr chunk_publisher_;
+  rclcpp::Publisher<whisper_idl::msg::CompressedAudio>::SharedPtr compressed_publisher_;
+  rclcpp::Publisher<std_msgs::msg::Int16MultiArray>::SharedPtr publisher_;
+
+private:
+  std::unique_ptr<AudioSourceBackend> backend_;
+  std::size_t chunk_frames_;
+  // Speed relative to real time, 0 publishes as fast as possible
+  double pace_;
+  std::uint64_t sequence_;
+  AudioEncoder encoder_;
+
+  std::thread thread_;
+  std::atomic<bool> running_;
+};
+} // end of namespace whisper
+#endif // WHISPER_NODES__AUDIO_SOURCE_HPP_
@@ -1,31 +1,52 @@
 #ifndef WHISPER_NODES__INFERENCE_NODE_HPP_
 #define WHISPER_NODES__INFERENCE_NODE_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <stdexcept>
 #include <string>
-// #include <mutex>
+#include <thread>
+#include <vector>
 
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
 #include "rcl_interfaces/msg/set_parameters_result.hpp"
 #include "rclcpp/rclcpp.hpp"
 #include "rclcpp_action/rclcpp_action.hpp"
 #include "std_msgs/msg/int16_multi_array.hpp"
 
+#include "whisper_util/audio_archive.hpp"
 #include "whisper_util/audio_buffers.hpp"
+#include "whisper_util/audio_codec.hpp"
+#include "whisper_util/drift_estimator.hpp"
+#include "whisper_util/jitter_buffer.hpp"
+#include "whisper_util/mailbox.hpp"
+#include "whisper_util/mel_spectrogram.hpp"
 #include "whisper_util/model_manager.hpp"
+#include "whisper_util/resampler.hpp"
+#include "whisper_util/vad.hpp"
 #include "whisper_util/whisper.hpp"
 #include "whisper_util/chrono_utils.hpp"
 
 #include "whisper_idl/action/inference.hpp"
+#include "whisper_idl/msg/audio_chunk.hpp"
+#include "whisper_idl/msg/compressed_audio.hpp"
+#include "whisper_idl/msg/stamped_audio.hpp"
 #include "whisper_idl/msg/whisper_tokens.hpp"
+#include "whisper_idl/srv/retranscribe.hpp"
 
 namespace whisper {
 
 class Inference : public rclcpp::Node {
 public:
   Inference(const rclcpp::NodeOptions& options);
+  ~Inference();
 
 protected:
   // parameters
@@ -34,30 +55,194 @@ protected:
   rcl_interfaces::msg::SetParametersResult
   on_parameter_set_(const std::vector<rclcpp::Parameter> &parameters);
 
-  // audio subscription
-  rclcpp::Subscription<std_msgs::msg::Int16MultiArray>::SharedPtr audio_sub_;
-  void on_audio_(const std_msgs::msg::Int16MultiArray::SharedPtr msg);
+  // audio subscriptions:  One per topic (microphone), each with its own ring.  Everything but
+  //    the SNR and last_inferred_sample is only touched from the audio callback group
+  struct AudioInput {
+    std::string topic;
+    rclcpp::SubscriptionBase::SharedPtr subscription;
+    std::unique_ptr<AudioRing> ring;
+    // Rolling spectrogram of the ring, if mel.incremental
+    std::unique_ptr<MelRing> mel;
+    // Conversion to 16 kHz mono
+    std::unique_ptr<Resampler> resampler;
+    std::vector<std::int16_t> resampled;
+    // Reorders stamped audio
+    std::unique_ptr<JitterBuffer> jitter_buffer;
+    std::uint64_t zero_filled_samples = 0;
+    // Compressed audio is decoded straight into the chunk the jitter buffer would keep
+    JitterBuffer::Chunk decoded;
+    std::uint64_t corrupt_chunks = 0;
+    // Source clock vs. ROS clock
+    std::unique_ptr<DriftEstimator> drift_estimator;
+    std::chrono::nanoseconds clock_offset{0};
+    double clock_skew = 0.;
+    // Signal to noise ratio of the window in dB, as of the last selection
+    std::atomic<float> snr{0.f};
+    // Only touched from the inference timer
+    std::uint64_t last_inferred_sample = 0;
+    // Audio before this absolute sample is transcribed for good, written by the inference thread
+    std::atomic<std::uint64_t> committed_sample{0};
+  };
+  rclcpp::SubscriptionBase::SharedPtr subscribe_(AudioInput &input, const std::string &audio_type,
+                                                 const rclcpp::SubscriptionOptions &options);
+  void on_audio_(const std_msgs::msg::Int16MultiArray::SharedPtr msg, AudioInput &input);
+  void on_stamped_audio_(const whisper_idl::msg::StampedAudio::SharedPtr msg,
+                         AudioInput &input);
+  void on_audio_chunk_(const whisper_idl::msg::AudioChunk::ConstSharedPtr msg,
+                       AudioInput &input);
+  void on_compressed_audio_(const whisper_idl::msg::CompressedAudio::ConstSharedPtr msg,
+                            AudioInput &input);
+  // Play out all chunks the jitter buffer releases
+  void drain_jitter_buffer_(AudioInput &input, std::chrono::system_clock::time_point arrival);
+  // Add a chunk captured at stamp, after filling the gap of lost chunks before it or moving the
+  //    ring's clock to stamp if the source restarted
+  void play_out_(AudioInput &input, const std::int16_t *data, std::size_t count,
+                 std::chrono::system_clock::time_point stamp,
+                 std::size_t sample_rate, std::size_t channels, long lost, bool restarted);
+  // Downmix / resample to 16 kHz mono and add to the input's ring
+  void enqueue_audio_(AudioInput &input, const std::int16_t *data, std::size_t count,
+                      std::size_t sample_rate, std::size_t channels);
+
+  // Pick the input with the best SNR for this tick, whisper only runs on that one
+  std::size_t select_input_();
+  float selection_hysteresis_db_;
+  std::atomic<std::size_t> selected_;
+  std::atomic<std::uint64_t> input_switches_;
+  std::vector<float> snr_scratch_;
+
+  // diagnostics
+  void correct_clock_drift_(AudioInput &input);
+  void add_input_values_(diagnostic_msgs::msg::DiagnosticStatus &status,
+                         const AudioInput &input);
+  void on_diagnostics_();
+  rclcpp::TimerBase::SharedPtr diagnostics_timer_;
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr diagnostics_pub_;
 
   // publsiher
   void timer_callback();
   rclcpp::TimerBase::SharedPtr timer_;
   rclcpp::Publisher<whisper_idl::msg::WhisperTokens>::SharedPtr publisher_;
+  // The running hypothesis, published whenever it completes a segment while whisper decodes
+  rclcpp::Publisher<whisper_idl::msg::WhisperTokens>::SharedPtr partial_publisher_;
   whisper_idl::msg::WhisperTokens create_message_();
 
   // whisper
   std::unique_ptr<ModelManager> model_manager_;
   std::unique_ptr<Whisper> whisper_;
-  std::mutex whisper_mutex_;
   std::string language_;
-  void initialize_whisper_();
+  void initialize_whisper_(Whisper &whisper, const std::string &model_name);
+
+  // archive:  Re-transcribe audio that already left the ring
+  void on_retranscribe_(const std::shared_ptr<whisper_idl::srv::Retranscribe::Request> request,
+                        std::shared_ptr<whisper_idl::srv::Retranscribe::Response> response);
+  rclcpp::Service<whisper_idl::srv::Retranscribe>::SharedPtr retranscribe_service_;
+  std::unique_ptr<AudioArchive> archive_;
+  // Separate model for re-transcription, if any, only used by the (exclusive) service callback.
+  //    The weights are shared with whisper_ if it is the same model
+  std::unique_ptr<Whisper> archive_whisper_;
+  std::vector<float> archive_snapshot_;
+  std::chrono::seconds archive_max_range_;
   
-  bool run_inference_(whisper_idl::msg::WhisperTokens &result);
-  void inference_(const std::vector<float> &audio, whisper_idl::msg::WhisperTokens &result);
+  // voice activity
+  bool window_has_speech_(AudioRing &ring);
+  bool vad_enabled_;
+  bool vad_publish_empty_;
+  VadThresholds vad_thresholds_;
+  std::mutex vad_mutex_;
+  std::vector<AudioBlock> vad_blocks_;
+  std::atomic<std::uint64_t> vad_skipped_ticks_;
+
+  // Leave leading silence (and the zero padding of the ring) out of the inference window
+  std::uint64_t trimmed_start_(AudioRing &ring);
+  bool trim_enabled_;
+  std::uint64_t trim_preroll_samples_;
+  std::uint64_t trim_min_samples_;
+
+  // Skip ticks without (enough) new audio since the last run
+  std::uint64_t min_new_samples_;
+  std::atomic<std::uint64_t> stale_skipped_ticks_;
+
+  // The timer only snapshots the window and posts it, whisper runs on the inference thread.
+  //    A window the thread did not get to yet is replaced by the newer one.
+  struct InferenceJob {
+    std::vector<float> audio;    // empty if mel holds the window
+    std::chrono::system_clock::time_point timestamp;
+    std::size_t input;
+    std::uint64_t first_sample;  // absolute index of audio[0] (or mel frame 0) in the input's ring
+    MelSpectrogram mel;          // of the same window, n_len 0 without a MelRing
+    std::uint64_t generation;    // counts posted jobs
+    std::chrono::steady_clock::time_point posted;
+    bool speech;                 // the block VAD found speech in the window
+  };
+  bool post_inference_(std::size_t index, bool speech);
+  void run_inference_();
+  Mailbox<InferenceJob> mailbox_;
+  // Only touched from the inference timer, its buffer is reused between ticks
+  InferenceJob job_;
+  std::thread inference_thread_;
+  std::atomic<std::uint64_t> superseded_ticks_;
+  std::atomic<std::uint64_t> posted_generation_;
+
+  // Abort inference that is too late (abort.deadline_ms after posting) or superseded by a newer
+  //    window, but never two windows in a row
+  std::chrono::milliseconds abort_after_;
+  bool abort_superseded_;
+  std::atomic<std::uint64_t> aborted_inferences_;
+
+  // Commit and advance:  Segments that agreed in the last agreement windows are final, later
+  //    windows start at the end of the last one (minus an overlap) instead of re-inferring it
+  struct CommitSegment {
+    std::uint64_t end;                  // absolute sample
+    std::vector<whisper_token> tokens;  // text tokens only
+  };
+  void advance_commit_(const InferenceJob &job, const whisper_idl::msg::WhisperTokens &result);
+  bool commit_enabled_;
+  std::size_t commit_agreement_;
+  std::uint64_t commit_overlap_samples_;
+  std::uint64_t commit_min_samples_;
+  // Only touched from the inference thread
+  std::deque<std::vector<CommitSegment>> hypotheses_;
+  std::size_t hypotheses_input_;
+  std::atomic<std::uint64_t> committed_segments_;
+  // The text of the latest committed segments (up to prompt.max_tokens, 0 disables) is decoded
+  //    ahead of every window, so whisper continues the transcript instead of starting cold.
+  //    Only segments that end before the window, and not more than prompt.max_gap_ms before it.
+  void build_prompt_(const InferenceJob &job);
+  std::size_t prompt_max_tokens_;
+  std::uint64_t prompt_max_gap_samples_;
+  // Only touched from the inference thread
+  std::deque<CommitSegment> prompt_segments_;
+  std::vector<whisper_token> prompt_;
+
+  // Adaptive cadence:  The timer fires every min_ms, a window is only posted once the period
+  //    derived from the (smoothed) inference duration has passed
+  void update_cadence_(std::chrono::milliseconds duration);
+  bool cadence_enabled_;
+  std::chrono::milliseconds cadence_min_;
+  std::chrono::milliseconds cadence_max_;
+  double cadence_target_utilization_;
+  double cadence_smoothing_;
+  // Written by the inference thread
+  std::atomic<double> inference_ms_ewma_;
+  std::atomic<std::int64_t> period_ms_;
+  // Only touched from the inference timer
+  std::chrono::steady_clock::time_point next_tick_;
+  bool inference_(Whisper &whisper, const std::vector<float> &audio,
+                  whisper_idl::msg::WhisperTokens &result, const MelSpectrogram *mel = nullptr,
+                  const Deadline &deadline = Deadline(),
+                  const Whisper::SegmentCallback &on_segment = Whisper::SegmentCallback(),
+                  const std::vector<whisper_token> &prompt = std::vector<whisper_token>(),
+                  bool speech = true);
 
 private:
   // Data
   std::chrono::milliseconds update_ms_;
-  std::unique_ptr<AudioRing> audio_ring_;
+  std::vector<std::unique_ptr<AudioInput>> inputs_;
+  // Optional process-wide ring other components can read the same audio from (first input)
+  std::shared_ptr<BroadcastRing<std::int16_t>> audio_bus_;
+  // Input format, used when the message does not carry it
+  std::size_t audio_sample_rate_;
+  std::size_t audio_channels_;
 
   // Control if whisper is running
   bool active_;
@@ -0,0 +1,212 @@
+#include "whisper_server/audio_source.hpp"
+
+namespace whisper {
+
+namespace {
+std::chrono::nanoseconds frames_to_time(std::uint64_t frames, std::uint32_t sample_rate) {
+  // Whole seconds first, so long running sources do not overflow
+  return std::chrono::seconds(frames / sample_rate) +
+         std::chrono::nanoseconds((frames % sample_rate) * 1000000000ull / sample_rate);
+}
+} // end of anonymous namespace
+
+AudioSource::AudioSource(const rclcpp::NodeOptions& options)
+    : Node("audio_source", options), sequence_(0), running_(false) {
+  declare_parameters_();
+
+  backend_ = create_backend_();
+  chunk_frames_ = std::max<std::size_t>(
+        get_parameter("chunk_ms").as_int() * backend_->sample_rate() / 1000, 1);
+  pace_ = std::max(get_parameter("pace").as_double(), 0.);
+
+  // Same message types the inference node subscribes to, see its audio_type parameter
+  auto audio_type = get_parameter("audio_type").as_string();
+  if ( audio_type == "stamped" ) {
+    stamped_publisher_ = create_publisher<whisper_idl::msg::StampedAudio>(
+        "~/audio", rclcpp::SensorDataQoS());
+  } else if ( audio_type == "chunk" ) {
+    chunk_publisher_ = create_publisher<whisper_idl::msg::AudioChunk>(
+        "~/audio", rclcpp::SensorDataQoS());
+    // Chunks have a fixed capacity
+    const std::size_t max_frames = whisper_idl::msg::AudioChunk::CAPACITY / backend_->channels();
+    if ( chunk_frames_ > max_frames ) {
+      RCLCPP_WARN(get_logger(), "chunk_ms too long for AudioChunk, publishing %zu frames.",
+                  max_frames);
+      chunk_frames_ = max_frames;
+    }
+  } else if ( audio_type == "compressed" ) {
+    compressed_publisher_ = create_publisher<whisper_idl::msg::CompressedAudio>(
+        "~/audio", rclcpp::SensorDataQoS());
+  } else if ( audio_type == "int16_multi_array" ) {
+    publisher_ = create_publisher<std_msgs::msg::Int16MultiArray>(
+        "~/audio", rclcpp::SensorDataQoS());
+  } else {
+    std::string err_msg = "Unknown audio_type " + audio_type + ".";
+    RCLCPP_ERROR(get_logger(), err_msg.c_str());
+    throw std::runtime_error(err_msg);
+  }
+
+  RCLCPP_INFO(get_logger(), "Publishing %u Hz audio with %u channel(s) from %s.",
+              backend_->sample_rate(), backend_->channels(),
+              get_parameter("source").as_string().c_str());
+  running_ = true;
+  thread_ = std::thread(&AudioSource::run_, this);
+}
+
+AudioSource::~AudioSource() {
+  running_ = false;
+  if ( thread_.joinable() ) {
+    thread_.join();
+  }
+}
+
+void AudioSource::declare_parameters_() {
+  declare_parameter("source", "synthetic");
+  declare_parameter("path", "");
+  declare_parameter("sample_rate", WHISPER_SAMPLE_RATE);
+  declare_parameter("channels", 1);
+  declare_parameter("chunk_ms", 100);
+  declare_parameter("pace", 1.);
+  declare_parameter("loop", false);
+  declare_parameter("audio_type", "stamped");
+  declare_parameter("synthetic.waveform", "tone");
+  declare_parameter("synthetic.frequency", 440.);
+  declare_parameter("synthetic.amplitude", 0.1);
+}
+
+std::unique_ptr<AudioSourceBackend> AudioSource::create_backend_() {
+  const auto source = get_parameter("source").as_string();
+  const auto path = get_parameter("path").as_string();
+  const auto sample_rate = get_parameter("sample_rate").as_int();
+  const auto channels = get_parameter("channels").as_int();
+  if ( sample_rate <= 0 || channels <= 0 ) {
+    std::string err_msg = "sample_rate and channels must be positive.";
+    RCLCPP_ERROR(get_logger(), err_msg.c_str());
+    throw std::runtime_error(err_msg);
+  }
+
+  if ( source == "file" ) {
+    return std::make_unique<FileSource>(path, sample_rate, channels,
+                                        get_parameter("loop").as_bool());
+  }
+  if ( source == "pipe" ) {
+    return std::make_unique<PipeSource>(path.empty() ? "-" : path, sample_rate, channels);
+  }
+  if ( source == "synthetic" ) {
+    const auto waveform = get_parameter("synthetic.waveform").as_string();
+    if ( waveform != "tone" && waveform != "noise" ) {
+      std::string err_msg = "Unknown synthetic.waveform " + waveform + ".";
+      RCLCPP_ERROR(get_logger(), err_msg.c_str());
+      throw std::runtime_error(err_msg);
+    }
+    return std::make_unique<SyntheticSource>(
+              waveform == "tone" ? SyntheticSource::Waveform::Tone
+                                 : SyntheticSource::Waveform::Noise,
+              sample_rate, channels, get_parameter("synthetic.frequency").as_double(),
+              get_parameter("synthetic.amplitude").as_double());
+  }
+  std::string err_msg = "Unknown source " + source + ".";
+  RCLCPP_ERROR(get_logger(), err_msg.c_str());
+  throw std::runtime_error(err_msg);
+}
+
+void AudioSource::run_() {
+  const std::uint32_t sample_rate = backend_->sample_rate();
+  const std::size_t channels = backend_->channels();
+  const auto start = std::chrono::steady_clock::now();
+  const auto start_stamp = ros_time_to_chrono(get_clock()->now());
+  std::uint64_t frames_published = 0;
+
+  while ( running_ && rclcpp::ok() && !backend_->done() ) {
+    std::vector<std::int16_t> data(chunk_frames_ * channels);
+    const std::size_t frames = backend_->read(data.data(), chunk_frames_);
+    if ( frames == 0 ) {
+      continue;
+    }
+    data.resize(frames * channels);
+
+    if ( backend_->live() ) {
+      // The read returned once the last frame arrived, stamp the first one
+      publish_(std::move(data), ros_time_to_chrono(get_clock()->now()) -
+                                frames_to_time(frames, sample_rate));
+      continue;
+    }
+
+    // A chunk is due once its last frame would have been captured
+    if ( pace_ > 0. ) {
+      std::this_thread::sleep_until(start +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                frames_to_time(frames_published + frames, sample_rate) / pace_));
+    }
+    publish_(std::move(data), start_stamp + std::chrono::duration_cast<
+                std::chrono::system_clock::duration>(
+                  frames_to_time(frames_published, sample_rate)));
+    frames_published += frames;
+  }
+  if ( backend_->done() ) {
+    RCLCPP_INFO(get_logger(), "Audio source finished after %lu chunks.", sequence_);
+  }
+}
+
+void AudioSource::publish_(std::vector<std::int16_t> &&data,
+                           std::chrono::system_clock::time_point stamp) {
+  // Published as unique_ptr, so an intra-process subscriber takes the message without a copy
+  if ( stamped_publisher_ ) {
+    auto msg = std::make_unique<whisper_idl::msg::StampedAudio>();
+    msg->stamp = chrono_to_ros_msg(stamp);
+    msg->sequence = sequence_++;
+    msg->sample_rate = backend_->sample_rate();
+    msg->channels = backend_->channels();
+    msg->data = std::move(data);
+    stamped_publisher_->publish(std::move(msg));
+    return;
+  }
+  if ( compressed_publisher_ ) {
+    auto msg = std::make_unique<whisper_idl::msg::CompressedAudio>();
+    msg->stamp = chrono_to_ros_msg(stamp);
+    msg->sequence = sequence_++;
+    msg->sample_rate = backend_->sample_rate();
+    msg->channels = backend_->channels();
+    msg->frames = data.size() / backend_->channels();
+    encoder_.encode(data.data(), msg->frames, msg->channels, msg->data);
+    compressed_publisher_->publish(std::move(msg));
+    return;
+  }
+  if ( chunk_publisher_ ) {
+    // Loaned from the middleware if it supports it (shared memory), allocated otherwise
+    auto loaned = chunk_publisher_->borrow_loaned_message();
+    auto &msg = loaned.get();
+    msg.stamp = chrono_to_ros_msg(stamp);
+    msg.sequence = sequence_++;
+    msg.sample_rate = backend_->sample_rate();
+    msg.channels = backend_->channels();
+    msg.count = data.size();
+    std::copy(data.begin(), data.end(), msg.data.begin());
+    chunk_publisher_->publish(std::move(loaned));
+    return;
+  }
+
+  auto msg = std::make_unique<std_msgs::msg::Int16MultiArray>();
+  msg->layout.data_offset = 0;
+  std_msgs::msg::MultiArrayDimension dim;
+  dim.label = "audio";
+  dim.size = data.size() / backend_->channels();
+  dim.stride = 1;
+  msg->layout.dim.push_back(dim);
+  if ( backend_->channels() > 1 ) {
+    // Interleaved channels, see the inference node's audio.channels parameter
+    dim.label = "channels";
+    dim.size = backend_->channels();
+    dim.stride = backend_->channels();
+    msg->layout.dim.push_back(dim);
+  }
+  msg->data = std::move(data);
+  ++sequence_;
+  publisher_->publish(std::move(msg));
+}
+
+} // end of namespace whisper
+
+
+#include "rclcpp_components/register_node_macro.hpp"
+RCLCPP_COMPONENTS_REGISTER_NODE(whisper::AudioSource)
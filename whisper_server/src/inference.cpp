@@ -1,60 +1,326 @@
 #include "whisper_server/inference.hpp"
 
 namespace whisper {
+
+namespace {
+// Samples a compressed chunk may decode to, anything larger is treated as corrupt
+constexpr std::size_t max_compressed_samples = 1 << 20;
+} // end of anonymous namespace
+
 Inference::Inference(const rclcpp::NodeOptions& options)
     : Node("inference", options), language_("en") {
   declare_parameters_();
 
-  // audio subscription:  Allow parallel callbacks
-  auto cb_group = create_callback_group(rclcpp::CallbackGroupType::Reentrant);
+  // audio subscription:  Runs in parallel to inference, but never in parallel to itself since
+  //    the audio ring is single-producer.  The inference timer only posts work to the inference
+  //    thread, so it neither blocks the executor nor overlaps itself.
+  auto cb_group = create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+  auto audio_cb_group = create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
   rclcpp::SubscriptionOptions sub_options;
-  sub_options.callback_group = cb_group;
-  audio_sub_ = create_subscription<std_msgs::msg::Int16MultiArray>(
-      "audio", rclcpp::SensorDataQoS(), 
-      std::bind(&Inference::on_audio_, this, std::placeholders::_1), sub_options);
+  sub_options.callback_group = audio_cb_group;
+  auto audio_type = get_parameter("audio_type").as_string();
+  auto audio_topics = get_parameter("audio_topics").as_string_array();
+  if ( audio_topics.empty() ) {
+    std::string err_msg = "audio_topics must name at least one topic.";
+    RCLCPP_ERROR(get_logger(), err_msg.c_str());
+    throw std::runtime_error(err_msg);
+  }
+
+  // Data:  One ring per microphone
+  auto audio_ring_s_ = std::chrono::seconds(get_parameter("buffer_capacity").as_int());
+  for (const auto &topic : audio_topics) {
+    auto input = std::make_unique<AudioInput>();
+    input->topic = topic;
+    input->ring = std::make_unique<AudioRing>(audio_ring_s_);
+    input->jitter_buffer = std::make_unique<JitterBuffer>(
+                        std::chrono::milliseconds(get_parameter("jitter_ms").as_int()), 64,
+                        std::chrono::milliseconds(get_parameter("jitter_restart_ms").as_int()));
+    input->drift_estimator = std::make_unique<DriftEstimator>(
+                        get_parameter("drift.window_chunks").as_int());
+    input->subscription = subscribe_(*input, audio_type, sub_options);
+    inputs_.push_back(std::move(input));
+  }
+  selection_hysteresis_db_ = get_parameter("selection.hysteresis_db").as_double();
+  selected_ = 0;
+  input_switches_ = 0;
+  if ( inputs_.size() > 1 ) {
+    RCLCPP_INFO(get_logger(), "Selecting the best of %zu audio topics.", inputs_.size());
+  }
 
   // parameter callback handle
   on_parameter_set_handle_ = add_on_set_parameters_callback(
       std::bind(&Inference::on_parameter_set_, this, std::placeholders::_1));
 
-  // Data
-  auto audio_ring_s_ = std::chrono::seconds(get_parameter("buffer_capacity").as_int());
-  audio_ring_ = std::make_unique<AudioRing>(audio_ring_s_);
+  auto audio_bus_name = get_parameter("audio_bus").as_string();
+  if ( !audio_bus_name.empty() ) {
+    // Share the incoming audio with other components in this process
+    audio_bus_ = get_audio_bus(audio_bus_name, time_to_count(audio_ring_s_));
+    RCLCPP_INFO(get_logger(), "Sharing audio on bus %s.", audio_bus_name.c_str());
+  }
+  vad_enabled_ = get_parameter("vad.enabled").as_bool();
+  vad_publish_empty_ = get_parameter("vad.publish_empty").as_bool();
+  vad_thresholds_.min_rms = std::pow(10.f, get_parameter("vad.min_rms_db").as_double() / 20.);
+  vad_thresholds_.max_zero_crossing_rate =
+                          get_parameter("vad.max_zero_crossing_rate").as_double();
+  vad_thresholds_.min_spectral_flux = get_parameter("vad.min_spectral_flux").as_double();
+  // The thresholds also decide whether a window has speech at all, not only for the VAD
+  for (auto &input : inputs_) {
+    input->ring->set_spectral_flux(vad_thresholds_.min_spectral_flux > 0.f);
+  }
+  vad_skipped_ticks_ = 0;
+  trim_enabled_ = get_parameter("trim.enabled").as_bool();
+  trim_preroll_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("trim.preroll_ms").as_int()));
+  trim_min_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("trim.min_window_ms").as_int()));
+  min_new_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("min_new_audio_ms").as_int()));
+  stale_skipped_ticks_ = 0;
+  auto sample_rate = get_parameter("audio.sample_rate").as_int();
+  auto channels = get_parameter("audio.channels").as_int();
+  if ( sample_rate <= 0 || channels <= 0 ) {
+    std::string err_msg = "audio.sample_rate and audio.channels must be positive.";
+    RCLCPP_ERROR(get_logger(), err_msg.c_str());
+    throw std::runtime_error(err_msg);
+  }
+  audio_sample_rate_ = sample_rate;
+  audio_channels_ = channels;
 
   // whisper
   model_manager_ = std::make_unique<ModelManager>();
   whisper_ = std::make_unique<Whisper>();
-  initialize_whisper_();
+  initialize_whisper_(*whisper_, get_parameter("model_name").as_string());
+  if ( get_parameter("mel.incremental").as_bool() ) {
+    // Spectrogram frames are computed as audio arrives instead of for the whole window per tick
+    const int n_mels = whisper_model_n_mels(whisper_->ctx);
+    for (auto &input : inputs_) {
+      input->mel = std::make_unique<MelRing>(time_to_count(audio_ring_s_), n_mels);
+    }
+  }
+
+  // Audio archive:  Keeps audio on disk for re-transcription after it left the ring
+  if ( get_parameter("archive.enabled").as_bool() ) {
+    auto archive_directory = get_parameter("archive.directory").as_string();
+    if ( archive_directory.empty() ) {
+      // HOME is often unset under systemd or in containers
+      const char *home = std::getenv("HOME");
+      if ( !home ) {
+        std::string err_msg = "HOME is not set, archive.directory is required.";
+        RCLCPP_ERROR(get_logger(), err_msg.c_str());
+        throw std::runtime_error(err_msg);
+      }
+      archive_directory = std::string(home) + "/.cache/whisper.cpp/archive";
+    }
+    archive_ = std::make_unique<AudioArchive>(archive_directory,
+                  std::chrono::seconds(get_parameter("archive.segment_s").as_int()),
+                  get_parameter("archive.max_segments").as_int(),
+                  std::chrono::milliseconds(get_parameter("archive.index_ms").as_int()));
+    RCLCPP_INFO(get_logger(), "Archiving audio to %s.", archive_directory.c_str());
+    archive_max_range_ = std::chrono::seconds(get_parameter("archive.max_range_s").as_int());
+
+    // Optionally with a separate (usually larger) model, which does not hold up live inference
+    auto archive_model_name = get_parameter("archive.model_name").as_string();
+    if ( !archive_model_name.empty() ) {
+      archive_whisper_ = std::make_unique<Whisper>();
+      initialize_whisper_(*archive_whisper_, archive_model_name);
+    }
+    retranscribe_service_ = create_service<whisper_idl::srv::Retranscribe>("retranscribe",
+          std::bind(&Inference::on_retranscribe_, this, std::placeholders::_1,
+                    std::placeholders::_2),
+          rmw_qos_profile_services_default,
+          create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive));
+  }
 
   // Inference publisher 
   auto callback_ms = std::chrono::milliseconds(get_parameter("callback_ms").as_int());
-  timer_ = create_wall_timer(callback_ms, std::bind(&Inference::timer_callback, this), cb_group);
+  cadence_enabled_ = get_parameter("cadence.enabled").as_bool();
+  cadence_min_ = std::chrono::milliseconds(get_parameter("cadence.min_ms").as_int());
+  cadence_max_ = std::chrono::milliseconds(get_parameter("cadence.max_ms").as_int());
+  cadence_target_utilization_ = get_parameter("cadence.target_utilization").as_double();
+  cadence_smoothing_ = get_parameter("cadence.smoothing").as_double();
+  if ( cadence_enabled_ && (cadence_min_.count() <= 0 || cadence_max_ < cadence_min_ ||
+                            cadence_target_utilization_ <= 0. ||
+                            cadence_smoothing_ <= 0. || cadence_smoothing_ > 1.) ) {
+    std::string err_msg = "cadence needs 0 < min_ms <= max_ms, target_utilization > 0 and "
+                          "smoothing in (0, 1].";
+    RCLCPP_ERROR(get_logger(), err_msg.c_str());
+    throw std::runtime_error(err_msg);
+  }
+  commit_enabled_ = get_parameter("commit.enabled").as_bool();
+  commit_agreement_ = std::max<std::int64_t>(get_parameter("commit.agreement").as_int(), 2);
+  commit_overlap_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("commit.overlap_ms").as_int()));
+  commit_min_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("commit.min_window_ms").as_int()));
+  hypotheses_input_ = 0;
+  committed_segments_ = 0;
+  prompt_max_tokens_ = std::max<std::int64_t>(get_parameter("prompt.max_tokens").as_int(), 0);
+  prompt_max_gap_samples_ = time_to_count(
+                      std::chrono::milliseconds(get_parameter("prompt.max_gap_ms").as_int()));
+  if ( prompt_max_tokens_ > 0 && !commit_enabled_ ) {
+    RCLCPP_WARN(get_logger(), "prompt.max_tokens has no effect without commit.enabled.");
+  }
+  inference_ms_ewma_ = -1.;
+  period_ms_ = callback_ms.count();
+  next_tick_ = std::chrono::steady_clock::now();
+  timer_ = create_wall_timer(cadence_enabled_ ? cadence_min_ : callback_ms,
+                             std::bind(&Inference::timer_callback, this), cb_group);
   publisher_ = create_publisher<whisper_idl::msg::WhisperTokens>("tokens", 10);
+  if ( get_parameter("partial.enabled").as_bool() ) {
+    partial_publisher_ = create_publisher<whisper_idl::msg::WhisperTokens>("tokens_partial", 10);
+    if ( get_parameter("audio_ctx.enabled").as_bool() ) {
+      RCLCPP_WARN(get_logger(), "partial.enabled and audio_ctx.enabled are both set, partials "
+                                "are only published for windows that fall back to the full "
+                                "audio_ctx.  Disable one of them.");
+    }
+  }
+
+  // Diagnostics share the audio callback group, so audio side counters need no locking
+  diagnostics_pub_ = create_publisher<diagnostic_msgs::msg::DiagnosticArray>("/diagnostics", 10);
+  diagnostics_timer_ = create_wall_timer(std::chrono::milliseconds(1000),
+                std::bind(&Inference::on_diagnostics_, this), audio_cb_group);
 
   active_ = get_parameter("active").as_bool();
+  superseded_ticks_ = 0;
+  posted_generation_ = 0;
+  abort_after_ = std::chrono::milliseconds(get_parameter("abort.deadline_ms").as_int());
+  abort_superseded_ = get_parameter("abort.superseded").as_bool();
+  aborted_inferences_ = 0;
+  inference_thread_ = std::thread(&Inference::run_inference_, this);
+}
+
+Inference::~Inference() {
+  mailbox_.close();
+  if ( inference_thread_.joinable() ) {
+    inference_thread_.join();
+  }
 }
 
 void Inference::timer_callback()
 {
   if ( active_ ) {
-    auto msg = create_message_();
-    auto success = run_inference_(msg);
-    if ( success ) {
-      publisher_->publish(msg);
-
-      auto& clk = *get_clock();
-      RCLCPP_INFO_THROTTLE(get_logger(), clk, 5000,
-                        "Whisper Induced Lag:   %ld (ms).",
-                        msg.inference_duration);
+    if ( cadence_enabled_ ) {
+      const auto now = std::chrono::steady_clock::now();
+      if ( now < next_tick_ ) {
+        return;
+      }
+      // Due half a timer period early, so the period does not round up to the next timer tick
+      next_tick_ = now + std::chrono::milliseconds(period_ms_) - cadence_min_ / 2;
     }
+    const std::size_t selected = select_input_();
+    auto &input = *inputs_[selected];
+    // Without speech, whisper may accept an empty result from a shortened audio_ctx
+    const bool speech = window_has_speech_(*input.ring);
+    if ( vad_enabled_ && !speech ) {
+      // Nothing but silence in the window, don't waste time on whisper
+      ++vad_skipped_ticks_;
+      if ( vad_publish_empty_ ) {
+        auto msg = create_message_();
+        msg.stamp = chrono_to_ros_msg(input.ring->get_start_timestamp());
+        publisher_->publish(msg);
+      }
+      return;
+    }
+    post_inference_(selected, speech);
   }
 }
 
+std::size_t Inference::select_input_() {
+  if ( inputs_.size() == 1 ) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(vad_mutex_);
+  for (auto &input : inputs_) {
+    input->ring->peak_blocks(vad_blocks_);
+    input->snr = snr_db(vad_blocks_, snr_scratch_);
+  }
+  const std::size_t selected = selected_;
+  const std::size_t best = std::max_element(inputs_.begin(), inputs_.end(),
+                  [](const auto &a, const auto &b) { return a->snr < b->snr; }) - inputs_.begin();
+
+  // Only switch for a clear improvement, so similar microphones do not take turns
+  if ( inputs_[best]->snr > inputs_[selected]->snr + selection_hysteresis_db_ ) {
+    RCLCPP_DEBUG(get_logger(), "Switching from %s (%.1f dB) to %s (%.1f dB).",
+                 inputs_[selected]->topic.c_str(), inputs_[selected]->snr.load(),
+                 inputs_[best]->topic.c_str(), inputs_[best]->snr.load());
+    ++input_switches_;
+    selected_ = best;
+    return best;
+  }
+  return selected;
+}
+
+bool Inference::window_has_speech_(AudioRing &ring) {
+  std::lock_guard<std::mutex> lock(vad_mutex_);
+  ring.peak_blocks(vad_blocks_);
+  return std::any_of(vad_blocks_.begin(), vad_blocks_.end(),
+                     [this](const AudioBlock &block) { return is_speech(block, vad_thresholds_); });
+}
+
+std::uint64_t Inference::trimmed_start_(AudioRing &ring) {
+  const std::uint64_t end = ring.samples_written();
+  std::lock_guard<std::mutex> lock(vad_mutex_);
+  const std::uint64_t first_block = ring.peak_blocks(vad_blocks_);
+
+  // Start a little before the first block with speech (or at the end, if there is none)
+  auto speech = std::find_if(vad_blocks_.begin(), vad_blocks_.end(),
+                [this](const AudioBlock &block) { return is_speech(block, vad_thresholds_); });
+  std::uint64_t start = end;
+  if ( speech != vad_blocks_.end() ) {
+    start = (first_block + (speech - vad_blocks_.begin())) * AudioRing::block_size;
+  }
+  start -= std::min(start, trim_preroll_samples_);
+
+  // But never shorten the window below the minimum
+  return std::min(start, end - std::min(end, trim_min_samples_));
+}
+
 void Inference::declare_parameters_() {
   // buffer parameters
   declare_parameter("buffer_capacity", 2);
   declare_parameter("callback_ms", 200);
+  declare_parameter("min_new_audio_ms", 0);
+  declare_parameter("commit.enabled", false);
+  declare_parameter("commit.agreement", 2);
+  declare_parameter("commit.overlap_ms", 500);
+  declare_parameter("commit.min_window_ms", 1000);
+  declare_parameter("prompt.max_tokens", 0);
+  declare_parameter("prompt.max_gap_ms", 5000);
+  declare_parameter("abort.deadline_ms", 0);
+  declare_parameter("abort.superseded", false);
+  declare_parameter("cadence.enabled", false);
+  declare_parameter("cadence.min_ms", 200);
+  declare_parameter("cadence.max_ms", 3000);
+  declare_parameter("cadence.target_utilization", 0.7);
+  declare_parameter("cadence.smoothing", 0.2);
+  declare_parameter("partial.enabled", false);
   declare_parameter("active", false);
+  declare_parameter("audio_bus", "");
+  declare_parameter("audio_type", "int16_multi_array");
+  declare_parameter("audio_topics", std::vector<std::string>{"audio"});
+  declare_parameter("selection.hysteresis_db", 3.);
+  declare_parameter("jitter_ms", 100);
+  declare_parameter("jitter_restart_ms", 2000);
+  declare_parameter("audio.sample_rate", WHISPER_SAMPLE_RATE);
+  declare_parameter("audio.channels", 1);
+  declare_parameter("vad.enabled", false);
+  declare_parameter("vad.publish_empty", false);
+  declare_parameter("vad.min_rms_db", -45.);
+  declare_parameter("vad.max_zero_crossing_rate", 0.5);
+  declare_parameter("vad.min_spectral_flux", 0.);
+  declare_parameter("trim.enabled", false);
+  declare_parameter("trim.preroll_ms", 300);
+  declare_parameter("trim.min_window_ms", 2000);
+  declare_parameter("drift.enabled", false);
+  declare_parameter("drift.window_chunks", 600);
+  declare_parameter("drift.max_step_us", 1000);
+  declare_parameter("archive.enabled", false);
+  declare_parameter("archive.directory", "");
+  declare_parameter("archive.segment_s", 60);
+  declare_parameter("archive.max_segments", 60);
+  declare_parameter("archive.index_ms", 1000);
+  declare_parameter("archive.model_name", "");
+  declare_parameter("archive.max_range_s", 300);
 
   // whisper parameters
   declare_parameter("model_name", "base.en");
@@ -66,10 +332,13 @@ void Inference::declare_parameters_() {
   declare_parameter("cparams.flash_attn", true);
   declare_parameter("cparams.gpu_device", 0);
   declare_parameter("cparams.use_gpu", true);
+  declare_parameter("mel.incremental", false);
+  declare_parameter("audio_ctx.enabled", false);
+  declare_parameter("audio_ctx.granularity_ms", 1000);
+  declare_parameter("audio_ctx.margin_ms", 500);
 }
 
-void Inference::initialize_whisper_() {
-  std::string model_name = get_parameter("model_name").as_string();
+void Inference::initialize_whisper_(Whisper &whisper, const std::string &model_name) {
   RCLCPP_INFO(get_logger(), "Checking whether model %s is available...",
               model_name.c_str());
   if ( !model_manager_->is_available(model_name) ) {
@@ -85,15 +354,22 @@ void Inference::initialize_whisper_() {
   RCLCPP_INFO(get_logger(), "Model %s is available.", model_name.c_str());
 
   language_ = get_parameter("wparams.language").as_string();
-  whisper_->wparams.language = language_.c_str();
-  whisper_->wparams.n_threads = get_parameter("wparams.n_threads").as_int();
-  whisper_->wparams.print_progress = get_parameter("wparams.print_progress").as_bool();
-  whisper_->cparams.flash_attn = get_parameter("cparams.flash_attn").as_bool();
-  whisper_->cparams.gpu_device = get_parameter("cparams.gpu_device").as_int();
-  whisper_->cparams.use_gpu = get_parameter("cparams.use_gpu").as_bool();
+  whisper.wparams.language = language_.c_str();
+  whisper.wparams.n_threads = get_parameter("wparams.n_threads").as_int();
+  whisper.wparams.print_progress = get_parameter("wparams.print_progress").as_bool();
+  whisper.cparams.flash_attn = get_parameter("cparams.flash_attn").as_bool();
+  whisper.cparams.gpu_device = get_parameter("cparams.gpu_device").as_int();
+  whisper.cparams.use_gpu = get_parameter("cparams.use_gpu").as_bool();
+  if ( get_parameter("audio_ctx.enabled").as_bool() ) {
+    // Encoder frames are 20 ms
+    whisper.audio_ctx_granularity =
+                std::max<std::int64_t>(get_parameter("audio_ctx.granularity_ms").as_int() / 20, 1);
+    whisper.audio_ctx_margin = std::max<std::int64_t>(
+                get_parameter("audio_ctx.margin_ms").as_int() / 20, 0);
+  }
 
   RCLCPP_INFO(get_logger(), "Initializing model %s...", model_name.c_str());
-  whisper_->initialize(model_manager_->get_model_path(model_name));
+  whisper.initialize(model_manager_->get_model_path(model_name));
   RCLCPP_INFO(get_logger(), "Model %s initialized.", model_name.c_str());
 }
 
@@ -102,9 +378,10 @@ Inference::on_parameter_set_(const std::vector<rclcpp::Parameter> &parameters) {
   rcl_interfaces::msg::SetParametersResult result;
   for (const auto &parameter : parameters) {
     if ( parameter.get_name() == "n_threads" ) {
-      whisper_->wparams.n_threads = parameter.as_int();
-      RCLCPP_INFO(get_logger(), "Parameter %s set to %d.", parameter.get_name().c_str(),
-                  whisper_->wparams.n_threads);
+      // The inference thread may be copying wparams right now
+      whisper_->set_n_threads(parameter.as_int());
+      RCLCPP_INFO(get_logger(), "Parameter %s set to %ld.", parameter.get_name().c_str(),
+                  parameter.as_int());
       continue;
     }
     if ( parameter.get_name() == "active" ) {
@@ -113,6 +390,24 @@ Inference::on_parameter_set_(const std::vector<rclcpp::Parameter> &parameters) {
                   active_);
       continue;
     }
+    if ( parameter.get_name() == "buffer_capacity" ) {
+      if ( parameter.as_int() <= 0 ) {
+        result.reason = "Parameter buffer_capacity must be positive.";
+        result.successful = false;
+        RCLCPP_WARN(get_logger(), result.reason.c_str());
+        return result;
+      }
+      // Applied by the audio callback with the next chunk, keeps the newest audio
+      for (auto &input : inputs_) {
+        input->ring->resize(std::chrono::seconds(parameter.as_int()));
+        if ( input->mel ) {
+          input->mel->resize(time_to_count(std::chrono::seconds(parameter.as_int())));
+        }
+      }
+      RCLCPP_INFO(get_logger(), "Parameter %s set to %ld.", parameter.get_name().c_str(),
+                  parameter.as_int());
+      continue;
+    }
     result.reason = "Parameter " + parameter.get_name() + " not handled.";
     result.successful = false;
     RCLCPP_WARN(get_logger(), result.reason.c_str());
@@ -121,23 +416,317 @@ Inference::on_parameter_set_(const std::vector<rclcpp::Parameter> &parameters) {
   return result;
 }
 
-void Inference::on_audio_(const std_msgs::msg::Int16MultiArray::SharedPtr msg) {
-  if ( !audio_ring_->is_audio_start_set() ) {
-    audio_ring_->set_start_timestamp(ros_time_to_chrono(get_clock()->now()));
+rclcpp::SubscriptionBase::SharedPtr Inference::subscribe_(AudioInput &input,
+                const std::string &audio_type, const rclcpp::SubscriptionOptions &options) {
+  // The inputs outlive their subscriptions, so the callbacks may hold on to them
+  if ( audio_type == "stamped" ) {
+    return create_subscription<whisper_idl::msg::StampedAudio>(
+        input.topic, rclcpp::SensorDataQoS(),
+        [this, &input](const whisper_idl::msg::StampedAudio::SharedPtr msg) {
+          on_stamped_audio_(msg, input);
+        }, options);
+  }
+  if ( audio_type == "chunk" ) {
+    return create_subscription<whisper_idl::msg::AudioChunk>(
+        input.topic, rclcpp::SensorDataQoS(),
+        [this, &input](const whisper_idl::msg::AudioChunk::ConstSharedPtr msg) {
+          on_audio_chunk_(msg, input);
+        }, options);
+  }
+  if ( audio_type == "compressed" ) {
+    return create_subscription<whisper_idl::msg::CompressedAudio>(
+        input.topic, rclcpp::SensorDataQoS(),
+        [this, &input](const whisper_idl::msg::CompressedAudio::ConstSharedPtr msg) {
+          on_compressed_audio_(msg, input);
+        }, options);
+  }
+  if ( audio_type == "int16_multi_array" ) {
+    return create_subscription<std_msgs::msg::Int16MultiArray>(
+        input.topic, rclcpp::SensorDataQoS(),
+        [this, &input](const std_msgs::msg::Int16MultiArray::SharedPtr msg) {
+          on_audio_(msg, input);
+        }, options);
+  }
+  std::string err_msg = "Unknown audio_type " + audio_type + ".";
+  RCLCPP_ERROR(get_logger(), err_msg.c_str());
+  throw std::runtime_error(err_msg);
+}
+
+void Inference::on_audio_(const std_msgs::msg::Int16MultiArray::SharedPtr msg,
+                          AudioInput &input) {
+  auto arrival = ros_time_to_chrono(get_clock()->now());
+  if ( !input.ring->is_audio_start_set() ) {
+    input.ring->set_start_timestamp(arrival);
   }
   // on_audio_debug_print_(msg);
-  audio_ring_->enqueue(msg->data);
+  // A second dimension in the layout holds the interleaved channels
+  std::size_t channels = audio_channels_;
+  if ( msg->layout.dim.size() >= 2 && msg->layout.dim[1].size > 0 ) {
+    channels = msg->layout.dim[1].size;
+  }
+  enqueue_audio_(input, msg->data.data(), msg->data.size(), audio_sample_rate_, channels);
+  // Without capture stamps the best guess is that the chunk ended when it arrived
+  input.drift_estimator->add(input.ring->samples_written(), arrival);
+}
+
+void Inference::on_stamped_audio_(const whisper_idl::msg::StampedAudio::SharedPtr msg,
+                                  AudioInput &input) {
+  auto arrival = ros_time_to_chrono(get_clock()->now());
+  input.jitter_buffer->push({msg->sequence, ros_msg_to_chrono(msg->stamp),
+                             msg->sample_rate > 0 ? msg->sample_rate : audio_sample_rate_,
+                             msg->channels > 0 ? msg->channels : audio_channels_,
+                             std::move(msg->data)}, arrival);
+  drain_jitter_buffer_(input, arrival);
+}
+
+void Inference::on_audio_chunk_(const whisper_idl::msg::AudioChunk::ConstSharedPtr msg,
+                                AudioInput &input) {
+  auto arrival = ros_time_to_chrono(get_clock()->now());
+  const std::size_t sample_rate = msg->sample_rate > 0 ? msg->sample_rate : audio_sample_rate_;
+  const std::size_t channels = msg->channels > 0 ? msg->channels : audio_channels_;
+  const std::size_t count = std::min<std::size_t>(msg->count, msg->data.size());
+
+  // In order, play out straight from the (possibly loaned) message
+  if ( input.jitter_buffer->pass(msg->sequence, ros_msg_to_chrono(msg->stamp)) ) {
+    play_out_(input, msg->data.data(), count, ros_msg_to_chrono(msg->stamp), sample_rate,
+              channels, 0, false);
+    return;
+  }
+
+  // Otherwise it has to wait in the jitter buffer, which needs a copy
+  input.jitter_buffer->push({msg->sequence, ros_msg_to_chrono(msg->stamp),
+                             static_cast<std::uint32_t>(sample_rate),
+                             static_cast<std::uint16_t>(channels),
+                             std::vector<std::int16_t>(msg->data.begin(),
+                                                       msg->data.begin() + count)},
+                            arrival);
+  drain_jitter_buffer_(input, arrival);
+}
+
+void Inference::on_compressed_audio_(
+                const whisper_idl::msg::CompressedAudio::ConstSharedPtr msg, AudioInput &input) {
+  auto arrival = ros_time_to_chrono(get_clock()->now());
+  const std::size_t sample_rate = msg->sample_rate > 0 ? msg->sample_rate : audio_sample_rate_;
+  const std::size_t channels = msg->channels > 0 ? msg->channels : audio_channels_;
+
+  // Every coded sample takes at least one bit, don't let a bogus frame count allocate
+  const std::size_t samples = static_cast<std::size_t>(msg->frames) * channels;
+  if ( samples > msg->data.size() * 8 || samples > max_compressed_samples ) {
+    ++input.corrupt_chunks;
+    RCLCPP_WARN_THROTTLE(get_logger(), *get_clock(), 5000, "Dropped corrupt audio chunk %lu.",
+                         msg->sequence);
+    return;
+  }
+  JitterBuffer::Chunk &chunk = input.decoded;
+  chunk.data.resize(samples);
+  if ( !decode_audio(msg->data.data(), msg->data.size(), msg->frames, channels,
+                     chunk.data.data()) ) {
+    // Treated like a lost chunk, the gap is filled once the next one arrives
+    ++input.corrupt_chunks;
+    RCLCPP_WARN_THROTTLE(get_logger(), *get_clock(), 5000, "Dropped corrupt audio chunk %lu.",
+                         msg->sequence);
+    return;
+  }
+
+  chunk.sequence = msg->sequence;
+  chunk.stamp = ros_msg_to_chrono(msg->stamp);
+  chunk.sample_rate = static_cast<std::uint32_t>(sample_rate);
+  chunk.channels = static_cast<std::uint16_t>(channels);
+
+  // In order, play out and keep the buffer for the next chunk.  Otherwise hand it over.
+  if ( input.jitter_buffer->pass(chunk.sequence, chunk.stamp) ) {
+    play_out_(input, chunk.data.data(), chunk.data.size(), chunk.stamp, sample_rate, channels,
+              0, false);
+    return;
+  }
+  input.jitter_buffer->push(std::move(chunk), arrival);
+  chunk.data.clear();
+  drain_jitter_buffer_(input, arrival);
 }
 
-void Inference::inference_(const std::vector<float> &audio, 
-                                  whisper_idl::msg::WhisperTokens &result) {
+void Inference::drain_jitter_buffer_(AudioInput &input,
+                                     std::chrono::system_clock::time_point arrival) {
+  JitterBuffer::Chunk chunk;
+  long lost;
+  bool restarted;
+  while ( (lost = input.jitter_buffer->pop(chunk, arrival, &restarted)) >= 0 ) {
+    play_out_(input, chunk.data.data(), chunk.data.size(), chunk.stamp, chunk.sample_rate,
+              chunk.channels, lost, restarted);
+  }
+}
+
+void Inference::play_out_(AudioInput &input, const std::int16_t *data, std::size_t count,
+                          std::chrono::system_clock::time_point stamp,
+                          std::size_t sample_rate, std::size_t channels, long lost,
+                          bool restarted) {
+  if ( !input.ring->is_audio_start_set() ) {
+    // The end of the buffer is where the first chunk was captured
+    input.ring->set_start_timestamp(stamp);
+  } else if ( restarted ) {
+    // The source restarted, continue at its new capture time.  Forward the pause is silence,
+    //    backward the ring's clock has to be moved, the old stream's drift no longer applies.
+    RCLCPP_INFO(get_logger(), "Audio source on %s restarted.", input.topic.c_str());
+    if ( stamp < input.ring->sample_time(input.ring->samples_written()) ) {
+      input.ring->set_start_timestamp(stamp);
+    } else {
+      input.zero_filled_samples += input.ring->decay(stamp);
+    }
+    input.drift_estimator->clear();
+  } else if ( lost > 0 ) {
+    // Chunks went missing, pad with silence up to where this one was captured
+    auto zeros = input.ring->decay(stamp);
+    input.zero_filled_samples += zeros;
+    RCLCPP_DEBUG(get_logger(), "Lost %ld audio chunks on %s, filled %zu samples.", lost,
+                 input.topic.c_str(), zeros);
+  }
+  enqueue_audio_(input, data, count, sample_rate, channels);
+  const std::size_t frames = count / std::max<std::size_t>(channels, 1);
+  input.drift_estimator->add(input.ring->samples_written(), stamp +
+                             std::chrono::nanoseconds(frames * 1000000000ull / sample_rate));
+}
+
+void Inference::enqueue_audio_(AudioInput &input, const std::int16_t *data, std::size_t count,
+                               std::size_t sample_rate, std::size_t channels) {
+  if ( !input.resampler || input.resampler->input_rate() != sample_rate ||
+                           input.resampler->channels() != channels ) {
+    RCLCPP_INFO(get_logger(), "Receiving %zu Hz audio with %zu channel(s) on %s.",
+                sample_rate, channels, input.topic.c_str());
+    input.resampler = std::make_unique<Resampler>(sample_rate, channels);
+  }
+
+  // Convert to 16 kHz mono, unless it already is
+  const std::int16_t *mono = data;
+  std::size_t mono_count = count;
+  if ( !input.resampler->is_passthrough() ) {
+    input.resampled.clear();
+    input.resampler->process(data, count / channels, input.resampled);
+    mono = input.resampled.data();
+    mono_count = input.resampled.size();
+  }
+
+  // Archive and bus carry one continuous stream, the first microphone's
+  const bool primary = &input == inputs_.front().get();
+  if ( archive_ && primary ) {
+    archive_->append(mono, mono_count, input.ring->sample_time(input.ring->samples_written()));
+  }
+  if ( input.mel ) {
+    input.mel->enqueue(mono, mono_count, input.ring->samples_written());
+  }
+  input.ring->enqueue(mono, mono_count);
+  if ( audio_bus_ && primary ) {
+    audio_bus_->write(mono, mono_count);
+  }
+}
+
+void Inference::correct_clock_drift_(AudioInput &input) {
+  std::chrono::system_clock::time_point expected;
+  if ( !input.drift_estimator->estimate(input.ring->samples_written(), expected,
+                                        input.clock_skew) ) {
+    return;
+  }
+  input.clock_offset = expected - input.ring->sample_time(input.ring->samples_written());
+  if ( get_parameter("drift.enabled").as_bool() ) {
+    // Slew instead of stepping, so a single outlier cannot make timestamps jump
+    auto max_step = std::chrono::microseconds(get_parameter("drift.max_step_us").as_int());
+    input.ring->adjust_timestamps(std::clamp<std::chrono::nanoseconds>(
+                                        input.clock_offset, -max_step, max_step));
+  }
+}
+
+void Inference::add_input_values_(diagnostic_msgs::msg::DiagnosticStatus &status,
+                                  const AudioInput &input) {
+  auto add_value = [&status](const std::string &key, const auto &value) {
+    diagnostic_msgs::msg::KeyValue key_value;
+    key_value.key = key;
+    key_value.value = std::to_string(value);
+    status.values.push_back(key_value);
+  };
+  add_value("buffered_ms", count_to_time(input.ring->size()).count());
+  add_value("jitter_pending_chunks", input.jitter_buffer->size());
+  add_value("late_chunks", input.jitter_buffer->late_chunks());
+  add_value("lost_chunks", input.jitter_buffer->lost_chunks());
+  add_value("zero_filled_samples", input.zero_filled_samples);
+  add_value("corrupt_chunks", input.corrupt_chunks);
+  add_value("clock_offset_us",
+            std::chrono::duration_cast<std::chrono::microseconds>(input.clock_offset).count());
+  add_value("clock_skew_ppm", input.clock_skew * 1e6);
+}
+
+void Inference::on_diagnostics_() {
+  for (auto &input : inputs_) {
+    correct_clock_drift_(*input);
+  }
+
+  diagnostic_msgs::msg::DiagnosticArray msg;
+  msg.header.stamp = now();
+  diagnostic_msgs::msg::DiagnosticStatus status;
+  status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+  status.name = std::string(get_fully_qualified_name()) + ": audio";
+  status.hardware_id = get_fully_qualified_name();
+  status.message = "OK";
+
+  auto add_value = [&status](const std::string &key, const auto &value) {
+    diagnostic_msgs::msg::KeyValue key_value;
+    key_value.key = key;
+    key_value.value = std::to_string(value);
+    status.values.push_back(key_value);
+  };
+  add_value("vad_skipped_ticks", vad_skipped_ticks_.load());
+  add_value("stale_skipped_ticks", stale_skipped_ticks_.load());
+  add_value("superseded_ticks", superseded_ticks_.load());
+  add_value("aborted_inferences", aborted_inferences_.load());
+  add_value("committed_segments", committed_segments_.load());
+  add_value("audio_ctx_fallbacks", whisper_->audio_ctx_fallbacks.load());
+  add_value("inference_ms", std::max(inference_ms_ewma_.load(), 0.));
+  add_value("period_ms", period_ms_.load());
+  if ( inputs_.size() == 1 ) {
+    add_input_values_(status, *inputs_.front());
+    msg.status.push_back(status);
+    diagnostics_pub_->publish(msg);
+    return;
+  }
+
+  // Several microphones, one status each
+  add_value("selected_input", selected_.load());
+  add_value("input_switches", input_switches_.load());
+  msg.status.push_back(status);
+  for (const auto &input : inputs_) {
+    diagnostic_msgs::msg::DiagnosticStatus input_status;
+    input_status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+    input_status.name = std::string(get_fully_qualified_name()) + ": audio " + input->topic;
+    input_status.hardware_id = get_fully_qualified_name();
+    input_status.message = "OK";
+    add_input_values_(input_status, *input);
+    diagnostic_msgs::msg::KeyValue snr;
+    snr.key = "snr_db";
+    snr.value = std::to_string(input->snr.load());
+    input_status.values.push_back(snr);
+    msg.status.push_back(input_status);
+  }
+  diagnostics_pub_->publish(msg);
+}
+
+bool Inference::inference_(Whisper &whisper, const std::vector<float> &audio,
+                           whisper_idl::msg::WhisperTokens &result, const MelSpectrogram *mel,
+                           const Deadline &deadline,
+                           const Whisper::SegmentCallback &on_segment,
+                           const std::vector<whisper_token> &prompt, bool speech) {
   auto inference_start_time = now();
-  whisper_->forward_serialize(audio, 
+  bool success;
+  if ( mel && mel->n_len_org > 0 ) {
+    success = whisper.forward_serialize(*mel,
                       result.token_ids, result.token_texts, result.token_probs,
-                      result.segment_start_token_idxs, result.start_times, result.end_times);
+                      result.segment_start_token_idxs, result.start_times, result.end_times,
+                      deadline, on_segment, prompt, speech);
+  } else {
+    success = whisper.forward_serialize(audio,
+                      result.token_ids, result.token_texts, result.token_probs,
+                      result.segment_start_token_idxs, result.start_times, result.end_times,
+                      deadline, on_segment, prompt, speech);
+  }
   result.inference_duration =
       (now() - inference_start_time).to_chrono<std::chrono::milliseconds>().count();
-  return;
+  return success;
 }
 
 whisper_idl::msg::WhisperTokens Inference::create_message_() {
@@ -147,30 +736,271 @@ whisper_idl::msg::WhisperTokens Inference::create_message_() {
   return msg;
 }
 
-bool Inference::run_inference_(whisper_idl::msg::WhisperTokens &result) {
-  const auto& [data, timestamp] = audio_ring_->peak();
-  result.stamp = chrono_to_ros_msg(timestamp);
-
-  inference_(data, result);
+bool Inference::post_inference_(std::size_t index, bool speech) {
+  auto &input = *inputs_[index];
+  // Nothing (or too little) arrived since the last run, the result would be the same
+  const std::uint64_t new_samples = input.ring->samples_written() - input.last_inferred_sample;
+  if ( new_samples == 0 || new_samples < min_new_samples_ ) {
+    ++stale_skipped_ticks_;
+    return false;
+  }
 
-  // Print warning if inference takes too long for audio size
-  auto duration = std::chrono::milliseconds(result.inference_duration);
-  auto max_runtime_for_audio_size = whisper::count_to_time(data.size());
-  if ( duration > max_runtime_for_audio_size ){
-        auto timeout_duration_ms = max_runtime_for_audio_size.count();
-        RCLCPP_WARN(get_logger(),
-              "Inference took longer than audio buffer size. This leads to un-inferenced audio "
-              "data. Consider increasing thread number or compile with accelerator support. \n "
-              "\t Inference Duration:   %lld,  Timeout after  %lld", 
-              static_cast<long long>(duration.count()), 
-              static_cast<long long>(timeout_duration_ms));
+  std::uint64_t from_sample = trim_enabled_ ? trimmed_start_(*input.ring) : 0;
+  if ( commit_enabled_ ) {
+    // Audio before the commit point is final, only a short overlap of it is inferred again
+    const std::uint64_t end = input.ring->samples_written();
+    std::uint64_t committed = input.committed_sample;
+    committed -= std::min(committed, commit_overlap_samples_);
+    // But never shorten the window below the minimum
+    from_sample = std::max(from_sample,
+                           std::min(committed, end - std::min(end, commit_min_samples_)));
+  }
+  job_.input = index;
+  job_.mel.n_len = job_.mel.n_len_org = 0;
+  if ( input.mel ) {
+    // Only the window's bounds are needed from the ring, whisper gets the spectrogram.  Its
+    //    times are relative to the first frame, which may start a few samples later.
+    std::uint64_t first_sample;
+    input.ring->peak_range(first_sample, input.last_inferred_sample, from_sample);
+    job_.first_sample = input.mel->peak_into(job_.mel, first_sample,
+                                             input.last_inferred_sample);
+    job_.timestamp = input.ring->sample_time(job_.first_sample);
+    job_.audio.clear();
+  }
+  if ( job_.mel.n_len_org == 0 ) {
+    // Without a MelRing (or none of its frames left) whisper computes the spectrogram itself
+    job_.timestamp = input.ring->peak_into(job_.audio, &job_.first_sample, from_sample);
+    input.last_inferred_sample = job_.first_sample + job_.audio.size();
+  }
+  job_.speech = speech;
+  job_.generation = ++posted_generation_;
+  job_.posted = std::chrono::steady_clock::now();
+  if ( mailbox_.post(job_) ) {
+    // The inference thread is still busy, the window it did not get to is covered by this one
+    ++superseded_ticks_;
   }
   return true;
 }
 
+void Inference::run_inference_() {
+  InferenceJob job;
+  bool aborted = false;
+  while ( mailbox_.take(job) ) {
+    auto msg = create_message_();
+    msg.stamp = chrono_to_ros_msg(job.timestamp);
+    // Never abort twice in a row.  When every window takes longer than the timer period (or the
+    //    deadline), aborting all of them would never publish anything again.
+    Deadline deadline;
+    if ( abort_after_.count() > 0 && !aborted ) {
+      deadline.time = job.posted + abort_after_;
+    }
+    if ( abort_superseded_ && !aborted ) {
+      deadline.latest = &posted_generation_;
+      deadline.generation = job.generation;
+    }
+    Whisper::SegmentCallback on_segment;
+    if ( partial_publisher_ ) {
+      // msg holds the hypothesis up to its latest segment, the result follows on tokens
+      const auto inference_start_time = now();
+      on_segment = [this, &msg, inference_start_time]() {
+        msg.inference_duration =
+            (now() - inference_start_time).to_chrono<std::chrono::milliseconds>().count();
+        partial_publisher_->publish(msg);
+      };
+    }
+    build_prompt_(job);
+    if ( !inference_(*whisper_, job.audio, msg, &job.mel, deadline, on_segment, prompt_,
+                     job.speech) && deadline.expired() ) {
+      // Too late to be of use, or a newer window is already waiting
+      ++aborted_inferences_;
+      aborted = true;
+      RCLCPP_DEBUG(get_logger(), "Aborted inference after %ld ms (%s).", msg.inference_duration,
+                   posted_generation_ > job.generation ? "superseded" : "deadline");
+      // At least this long, still tells the cadence that inference cannot keep up
+      update_cadence_(std::chrono::milliseconds(msg.inference_duration));
+      continue;
+    }
+    aborted = false;
+
+    // Print warning if inference takes too long for audio size
+    auto duration = std::chrono::milliseconds(msg.inference_duration);
+    const std::size_t window_samples = job.mel.n_len_org > 0 ?
+                                       job.mel.n_len_org * MelRing::hop_length : job.audio.size();
+    auto max_runtime_for_audio_size = whisper::count_to_time(window_samples);
+    if ( duration > max_runtime_for_audio_size ){
+          auto timeout_duration_ms = max_runtime_for_audio_size.count();
+          RCLCPP_WARN(get_logger(),
+                "Inference took longer than audio buffer size. This leads to un-inferenced audio "
+                "data. Consider increasing thread number or compile with accelerator support. \n "
+                "\t Inference Duration:   %lld,  Timeout after  %lld", 
+                static_cast<long long>(duration.count()), 
+                static_cast<long long>(timeout_duration_ms));
+    }
+
+    if ( commit_enabled_ ) {
+      advance_commit_(job, msg);
+    }
+    publisher_->publish(msg);
+    update_cadence_(duration);
+    auto& clk = *get_clock();
+    RCLCPP_INFO_THROTTLE(get_logger(), clk, 5000,
+                      "Whisper Induced Lag:   %ld (ms).",
+                      msg.inference_duration);
+  }
+}
+
+void Inference::advance_commit_(const InferenceJob &job,
+                                const whisper_idl::msg::WhisperTokens &result) {
+  // Hypotheses of another microphone say nothing about this one
+  if ( job.input != hypotheses_input_ ) {
+    hypotheses_.clear();
+    prompt_segments_.clear();
+    hypotheses_input_ = job.input;
+  }
+
+  // Segments of this window in absolute samples, whisper's segment times are in 10 ms
+  const whisper_token eot = whisper_token_eot(whisper_->ctx);
+  const std::size_t n_segments = result.segment_start_token_idxs.size();
+  std::vector<CommitSegment> segments(n_segments);
+  for (std::size_t i = 0; i < n_segments; ++i) {
+    segments[i].end = job.first_sample + result.end_times[i] * (WHISPER_SAMPLE_RATE / 100);
+    const std::size_t last = i + 1 < n_segments ? result.segment_start_token_idxs[i + 1]
+                                                : result.token_ids.size();
+    for (std::size_t j = result.segment_start_token_idxs[i]; j < last; ++j) {
+      // Timestamp and other special tokens differ between windows
+      if ( result.token_ids[j] < eot ) {
+        segments[i].tokens.push_back(result.token_ids[j]);
+      }
+    }
+  }
+  hypotheses_.push_back(std::move(segments));
+  if ( hypotheses_.size() > commit_agreement_ ) {
+    hypotheses_.pop_front();
+  }
+  if ( hypotheses_.size() < commit_agreement_ ) {
+    return;
+  }
+
+  // Segment boundaries move by a few hundred ms between windows
+  const std::uint64_t tolerance = time_to_count(std::chrono::milliseconds(1000));
+  auto same = [tolerance](const CommitSegment &a, const CommitSegment &b) {
+    return a.tokens == b.tokens &&
+           (a.end > b.end ? a.end - b.end : b.end - a.end) <= tolerance;
+  };
+
+  // Commit the leading segments every hypothesis agrees on.  The last one is never final, the
+  //    end of the window may have cut it off.
+  auto &input = *inputs_[job.input];
+  std::uint64_t committed = input.committed_sample;
+  const auto &newest = hypotheses_.back();
+  for (std::size_t i = 0; i + 1 < newest.size(); ++i) {
+    const bool agreed = std::all_of(hypotheses_.begin(), hypotheses_.end() - 1,
+                [&](const std::vector<CommitSegment> &hypothesis) {
+                  return std::any_of(hypothesis.begin(), hypothesis.end(),
+                          [&](const CommitSegment &other) { return same(other, newest[i]); });
+                });
+    if ( !agreed ) {
+      break;
+    }
+    if ( newest[i].end > committed ) {
+      committed = newest[i].end;
+      ++committed_segments_;
+      if ( prompt_max_tokens_ > 0 ) {
+        prompt_segments_.push_back(newest[i]);
+      }
+    }
+  }
+  input.committed_sample = committed;
+
+  // Only the end of the transcript is context for what comes next
+  std::size_t prompt_tokens = 0;
+  for (const auto &segment : prompt_segments_) {
+    prompt_tokens += segment.tokens.size();
+  }
+  while ( prompt_segments_.size() > 1 &&
+          prompt_tokens - prompt_segments_.front().tokens.size() >= prompt_max_tokens_ ) {
+    prompt_tokens -= prompt_segments_.front().tokens.size();
+    prompt_segments_.pop_front();
+  }
+}
+
+void Inference::build_prompt_(const InferenceJob &job) {
+  prompt_.clear();
+  if ( prompt_segments_.empty() || job.input != hypotheses_input_ ) {
+    return;
+  }
+
+  // Text of audio the window repeats would be dropped or doubled by whisper
+  auto end = std::find_if(prompt_segments_.begin(), prompt_segments_.end(),
+                          [&job](const CommitSegment &segment) {
+                            return segment.end > job.first_sample;
+                          });
+  if ( end == prompt_segments_.begin() ) {
+    return;
+  }
+  if ( job.first_sample - std::prev(end)->end > prompt_max_gap_samples_ ) {
+    // A long pause (or skipped audio) since, what was said before is no context anymore
+    prompt_segments_.clear();
+    return;
+  }
+  for (auto segment = prompt_segments_.begin(); segment != end; ++segment) {
+    prompt_.insert(prompt_.end(), segment->tokens.begin(), segment->tokens.end());
+  }
+  if ( prompt_.size() > prompt_max_tokens_ ) {
+    prompt_.erase(prompt_.begin(), prompt_.end() - prompt_max_tokens_);
+  }
+}
+
+void Inference::update_cadence_(std::chrono::milliseconds duration) {
+  double ewma = inference_ms_ewma_;
+  ewma = ewma < 0. ? duration.count()
+                   : cadence_smoothing_ * duration.count() + (1. - cadence_smoothing_) * ewma;
+  inference_ms_ewma_ = ewma;
+  if ( !cadence_enabled_ ) {
+    return;
+  }
+
+  // Keep the inference thread busy for target_utilization of the time: shorter periods (less
+  //    latency) on an idle machine, longer ones before inference falls behind the audio
+  period_ms_ = std::clamp<std::int64_t>(std::llround(ewma / cadence_target_utilization_),
+                                        cadence_min_.count(), cadence_max_.count());
+}
+
+void Inference::on_retranscribe_(
+                const std::shared_ptr<whisper_idl::srv::Retranscribe::Request> request,
+                std::shared_ptr<whisper_idl::srv::Retranscribe::Response> response) {
+  // The whole range is held in memory and decoded in one call
+  const auto start = ros_msg_to_chrono(request->start);
+  const auto end = ros_msg_to_chrono(request->end);
+  if ( end - start > archive_max_range_ ) {
+    response->success = false;
+    response->message = "The requested range is longer than archive.max_range_s (" +
+                        std::to_string(archive_max_range_.count()) + " s).";
+    return;
+  }
+  const auto timestamp = archive_->read(start, end, archive_snapshot_);
+  if ( archive_snapshot_.empty() ) {
+    response->success = false;
+    response->message = "No archived audio in the requested range.";
+    return;
+  }
+  response->tokens.stamp = chrono_to_ros_msg(timestamp);
+
+  // Runs alongside live inference, each call decodes with its own whisper state
+  if ( !inference_(archive_whisper_ ? *archive_whisper_ : *whisper_, archive_snapshot_,
+                   response->tokens) ) {
+    response->success = false;
+    response->message = "Whisper failed on the archived audio.";
+    return;
+  }
+  response->success = true;
+  response->message = "Transcribed " +
+                      std::to_string(count_to_time(archive_snapshot_.size()).count()) + " ms.";
+}
+
 void Inference::on_audio_debug_print_(const std_msgs::msg::Int16MultiArray::SharedPtr msg) {
-  auto audio_buff_start = audio_ring_->get_start_timestamp();
-  auto audio_buff_len_ms = count_to_time(audio_ring_->size());
+  auto audio_buff_start = inputs_.front()->ring->get_start_timestamp();
+  auto audio_buff_len_ms = count_to_time(inputs_.front()->ring->size());
   auto cur_time = ros_time_to_chrono(get_clock()->now());
   auto msg_duration_ms = count_to_time(msg->data.size());
   size_t elapsed_count;
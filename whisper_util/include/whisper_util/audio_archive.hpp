@@ -0,0 +1,87 @@
+#ifndef WHISPER_UTIL__AUDIO_ARCHIVE_HPP_
+#define WHISPER_UTIL__AUDIO_ARCHIVE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "whisper.h"
+
+namespace whisper {
+
+/**
+ * @brief Keeps 16 kHz mono audio on disk, long after it left the AudioRing.  Samples are appended
+ * to memory-mapped segment files of a fixed length, the oldest segment is deleted once there are
+ * more than max_segments.  A sparse index maps timestamps to sample offsets (one entry per
+ * index_interval, plus one wherever the stream jumps ahead), so any time range can be read
+ * back without scanning.  append and read may be called from different threads.
+ *
+ * Segment files are named after the capture time of their first sample and are kept when the
+ * archive is destroyed, so audio from earlier runs stays available for offline use.  They count
+ * towards max_segments of the next archive in the same directory and are deleted first.
+ */
+class AudioArchive {
+public:
+  AudioArchive(const std::string &directory, const std::chrono::seconds &segment_length,
+               const std::size_t &max_segments,
+               const std::chrono::milliseconds &index_interval = std::chrono::milliseconds(1000));
+  ~AudioArchive();
+
+  AudioArchive(const AudioArchive &) = delete;
+  AudioArchive &operator=(const AudioArchive &) = delete;
+
+  // Append count samples, the first of which was captured at stamp
+  void append(const std::int16_t *data, std::size_t count,
+              std::chrono::system_clock::time_point stamp);
+
+  // Copy the archived audio in [start, end) into out (converted to float).
+  //     :return: The capture time of out[0], out is empty if nothing in the range is archived
+  std::chrono::system_clock::time_point read(std::chrono::system_clock::time_point start,
+                                             std::chrono::system_clock::time_point end,
+                                             std::vector<float> &out) const;
+
+  // Time range currently on disk
+  std::chrono::system_clock::time_point oldest() const;
+  std::chrono::system_clock::time_point newest() const;
+
+protected:
+  struct Segment {
+    std::uint64_t first_sample;
+    std::string path;
+    int fd;
+    std::int16_t *data;
+  };
+
+  struct IndexEntry {
+    std::int64_t time_ns;  // capture time of sample
+    std::uint64_t sample;
+  };
+
+  // Start a new segment at written_, deleting the oldest one if there are too many
+  void open_segment_();
+  // Unmap a segment and either delete it or trim it to the samples that were written
+  void close_segment_(Segment &segment, bool remove);
+
+  // Map between capture times and archive samples, both need mutex_ and a non-empty index
+  std::uint64_t locate_(std::int64_t time_ns) const;
+  std::int64_t time_of_(std::uint64_t sample) const;
+
+  const std::string directory_;
+  const std::size_t segment_samples_;
+  const std::size_t max_segments_;
+  const std::uint64_t index_interval_;
+
+  mutable std::mutex mutex_;
+  std::deque<Segment> segments_;
+  // Segment files of earlier runs, oldest first
+  std::deque<std::string> previous_;
+  std::deque<IndexEntry> index_;
+  std::uint64_t written_;
+  std::int64_t next_time_ns_;  // where the stream is expected to continue
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__AUDIO_ARCHIVE_HPP_
@@ -1,13 +1,25 @@
 #ifndef WHISPER_UTIL__AUDIO_BUFFERS_HPP_
 #define WHISPER_UTIL__AUDIO_BUFFERS_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "whisper.h"
 
+#include "whisper_util/audio_conversion.hpp"
+#include "whisper_util/vad.hpp"
+
 namespace whisper {
 inline std::size_t time_to_count(const std::chrono::milliseconds &ms) {
   return ms.count() * WHISPER_SAMPLE_RATE / 1e3;
@@ -17,8 +29,20 @@ inline std::chrono::milliseconds count_to_time(const std::size_t &count) {
   return std::chrono::milliseconds(count * static_cast<std::size_t>(1e3) / WHISPER_SAMPLE_RATE);
 };
 
-inline std::chrono::nanoseconds count_to_time_ns(const std::size_t &count) {
-  return std::chrono::nanoseconds(count * static_cast<size_t>(1e9) / WHISPER_SAMPLE_RATE);
+inline std::chrono::nanoseconds count_to_time_ns(const std::uint64_t &count) {
+  // Split into whole seconds and a remainder so the product never overflows, even for sample
+  //    counters that have been running for years
+  constexpr std::uint64_t rate = WHISPER_SAMPLE_RATE;
+  return std::chrono::seconds(count / rate) +
+         std::chrono::nanoseconds((count % rate) * static_cast<std::uint64_t>(1e9) / rate);
+};
+
+inline std::uint64_t time_to_count_ns(const std::chrono::nanoseconds &ns) {
+  // Inverse of count_to_time_ns, rounded down to whole samples
+  constexpr std::uint64_t rate = WHISPER_SAMPLE_RATE;
+  const std::uint64_t count = ns.count();
+  return (count / static_cast<std::uint64_t>(1e9)) * rate +
+         (count % static_cast<std::uint64_t>(1e9)) * rate / static_cast<std::uint64_t>(1e9);
 };
 
 /**
@@ -79,48 +103,241 @@ protected:
 };
 
 /**
- * @brief A thread-safe buffer for storing audio data. The user enqueues data from an audio stream
- * in thread A and reads a copy of the data (peak) in thread B. 
+ * @brief A lock-free single-producer/single-consumer buffer for storing audio data. The user
+ * enqueues data from an audio stream in thread A and reads a copy of the data (peak) in thread B.
  * When buffer is full overwrite oldest data, so buffer contents are always the newest data in
  * the stream.
  *
- * Thread A: enqueue into _buffer 
- * Thread B: peak (copy) in-order from _buffer 
+ * Thread A: enqueue into the storage with at most two memcpy calls, then publish head_
+ * Thread B: peak (copy) in-order from the storage, then drop anything thread A overwrote meanwhile
+ *
+ * head_ and tail_ are monotonically increasing sample indices, a sample lives at
+ * samples[index % size] of the current Storage.  The storage holds one second more than the
+ * capacity, so thread A can keep writing while thread B copies without either of them having to
+ * wait.
  *
  */
-class AudioRing : public ThreadSafeRing<std::int16_t> {
+class AudioRing {
 private:
-  // Keep a timestamp of the start of the buffer.
-  std::chrono::system_clock::time_point audio_start_;
-  const std::chrono::nanoseconds time_inc_;
-  bool audio_start_set;
-
-protected:
-  // Overwrite this function to also increase the buffer audio_start_ timestamp when dropping data
-  void increment_tail_() override;
+  // Timestamp of sample index 0.  Timestamps are never accumulated, sample i is always at
+  //    origin_ + i / WHISPER_SAMPLE_RATE, so they stay sample-accurate regardless of uptime.
+  std::atomic<std::int64_t> origin_ns_;
+  std::atomic<bool> audio_start_set_;
+
+  /**
+   * @brief Samples and block summaries, replaced as a whole on resize.  Only thread A replaces
+   * storage_, thread B takes a reference with std::atomic_load, which keeps an old storage alive
+   * until the last reader is done with it.
+   */
+  struct Storage {
+    Storage(const std::size_t &capacity, const std::uint64_t &first_valid);
+
+    const std::size_t capacity;
+    const std::size_t size;          // capacity plus one second of slack for thread B
+    const std::uint64_t first_valid; // samples before this index were never copied in here
+    std::vector<std::int16_t> samples;
+    std::vector<AudioBlock> blocks;
+  };
+  std::shared_ptr<Storage> storage_;
+  std::atomic<std::size_t> capacity_;
+  // A capacity requested by resize(), applied by thread A with the next write (0: none)
+  std::atomic<std::size_t> pending_capacity_;
+
+  // Sample indices: [tail_, head_) is the data in the buffer, reserve_ is the index thread A is
+  //    currently writing up to (equal to head_ outside of enqueue)
+  std::atomic<std::uint64_t> head_;
+  std::atomic<std::uint64_t> tail_;
+  std::atomic<std::uint64_t> reserve_;
+
+  // One AudioBlock summary per block_size samples, block b lives at blocks[b % blocks.size()].
+  //    summarized_ is the first sample (thread A only) that is not summarized yet.
+  std::uint64_t summarized_;
+  std::unique_ptr<SpectralFlux> spectral_flux_;
+
+  // Copy (or zero-fill if data is a nullptr) count samples behind head_
+  void write_(const std::int16_t *data, std::size_t count);
+  // Summarize all complete blocks up to head
+  void summarize_(std::uint64_t head);
+  // Move the newest samples into a storage of a new capacity
+  void apply_resize_(std::size_t capacity);
+  // The storage and the window [start, head) thread B may read from it
+  std::shared_ptr<const Storage> window_(std::uint64_t &start, std::uint64_t &head) const;
 
 public:
+  // Samples per AudioBlock summary (20 ms)
+  static constexpr std::size_t block_size = WHISPER_SAMPLE_RATE / 50;
+
   AudioRing(const std::chrono::milliseconds &buffer_capacity,
                           std::chrono::system_clock::time_point cur_time);
   AudioRing(const std::chrono::milliseconds &buffer_capacity);
 
+  // Producer (thread A) functions
+  void enqueue(const std::vector<std::int16_t> &data);
+  void enqueue(const std::int16_t *data, std::size_t count);
+
   void set_start_timestamp(std::chrono::system_clock::time_point cur_time);
-  std::chrono::system_clock::time_point get_start_timestamp() const;
 
-  // Get a logical order copy of all data in ring buffer, along with the timestamp
-  std::tuple<std::vector<float>, std::chrono::system_clock::time_point> peak() const;
+  // Shift the timestamps of all samples, used to slew the ring towards a drift estimate
+  void adjust_timestamps(const std::chrono::nanoseconds &correction);
 
-  // Add zeros so the audio_start_ + count_to_time(size_) = cur_time.
+  // Add zeros so the timestamp of the end of the buffer is cur_time.
   //     :return: The number of zeros added.
   size_t decay(std::chrono::system_clock::time_point cur_time);
 
   void clear();
 
+  // Also compute the spectral flux of every block (needs an FFT per block)
+  void set_spectral_flux(bool enabled);
+
+  // Change the capacity, keeping the newest samples and their timestamps.  Safe to call from
+  //    any thread, takes effect with the next enqueue / decay.
+  void resize(const std::chrono::milliseconds &buffer_capacity);
+
+  // Consumer (thread B) functions
+  std::chrono::system_clock::time_point get_start_timestamp() const;
+
+  // Total number of samples written since construction, a monotonically increasing counter.
+  //    Serves as write sequence: if it did not change, neither did the buffer.
+  inline std::uint64_t samples_written() const { return head_.load(std::memory_order_acquire); }
+
+  // Timestamp of the sample with the absolute index (as counted by samples_written())
+  std::chrono::system_clock::time_point sample_time(const std::uint64_t &index) const;
+
+  // Get a logical order copy of all data in ring buffer, along with the timestamp
+  std::tuple<std::vector<float>, std::chrono::system_clock::time_point> peak() const;
+
+  // Same as peak(), but converts into a caller-owned buffer which is only reallocated when it
+  //    has to grow.  The wrap is handled as two linear runs.  If first_sample is given, it is
+  //    set to the absolute index of out[0], so out ends at *first_sample + out.size().
+  //    Data before the absolute index from_sample is left out, e.g. to skip leading silence.
+  //    :return: The timestamp of out[0].
+  std::chrono::system_clock::time_point peak_into(std::vector<float> &out,
+                                                  std::uint64_t *first_sample = nullptr,
+                                                  const std::uint64_t &from_sample = 0) const;
+
+  // The absolute indices [first_sample, end_sample) peak_into would copy, without copying them
+  void peak_range(std::uint64_t &first_sample, std::uint64_t &end_sample,
+                  const std::uint64_t &from_sample = 0) const;
+
+  // Copy the summaries of all complete blocks currently in the buffer.
+  //    :return: The absolute index of the first block, it starts at sample index * block_size.
+  std::uint64_t peak_blocks(std::vector<AudioBlock> &out) const;
+
+  std::size_t size() const;
+  inline std::size_t capacity() const { return capacity_.load(std::memory_order_acquire); }
+  inline bool is_full() const { return size() == capacity(); }
+  inline bool empty() const { return size() == 0; }
+
   bool is_audio_start_set() const {
-    return audio_start_set;
+    return audio_start_set_.load(std::memory_order_acquire);
   }
 };
 
+/**
+ * @brief What the writer of a BroadcastRing does when a reader falls a full capacity behind.
+ */
+enum class SlowReaderPolicy {
+  Overwrite,  // keep writing, the slow reader loses the oldest data (counted in lost())
+  Block       // wait until every reader has made room
+};
+
+/**
+ * @brief A disruptor-style ring with one writer and up to max_readers registered readers. Each
+ * reader has its own cursor and reads zero-copy spans straight out of the ring, so several
+ * consumers (e.g. inference, VAD, recorder) can share one copy of the audio.
+ *
+ * Writer thread:  write
+ * Reader threads: peek (zero-copy spans), then consume
+ *
+ * Like AudioRing, positions are monotonically increasing indices into buffer_[index % capacity_].
+ *
+ * @tparam value_type
+ */
+template <typename value_type> class BroadcastRing {
+public:
+  // A contiguous read-only view into the ring
+  struct Span {
+    const value_type *data;
+    std::size_t size;
+  };
+
+  /**
+   * @brief Handle of a registered reader, unregisters on destruction. The ring has to outlive
+   * its readers.
+   */
+  class Reader {
+  public:
+    ~Reader();
+
+    // Number of unread items (may exceed the capacity if the writer overwrote them)
+    std::size_t available() const;
+
+    // Up to max_count unread items in order, the second span is only non-empty on a wrap
+    std::pair<Span, Span> peek(std::size_t max_count = std::numeric_limits<std::size_t>::max());
+
+    // Advance the cursor past count peeked items.
+    //    :return: false if the writer overwrote (part of) them while they were being read
+    bool consume(std::size_t count);
+
+    // Items skipped because the writer overwrote them before they were read
+    inline std::uint64_t lost() const { return lost_; }
+
+  private:
+    friend class BroadcastRing<value_type>;
+    Reader(BroadcastRing<value_type> *ring, std::size_t slot);
+
+    BroadcastRing<value_type> *ring_;
+    std::size_t slot_;
+    std::uint64_t lost_;
+  };
+
+  BroadcastRing(const std::size_t &capacity, SlowReaderPolicy policy = SlowReaderPolicy::Overwrite,
+                const std::size_t &max_readers = 8);
+
+  // Register a new reader starting at the current write position.
+  //    :return: nullptr if all reader slots are taken
+  std::unique_ptr<Reader> register_reader();
+
+  // Write count items, blocks under SlowReaderPolicy::Block until all readers made room
+  void write(const value_type *data, std::size_t count);
+  void write(const std::vector<value_type> &data) { write(data.data(), data.size()); }
+
+  // Wake a blocked writer and stop blocking from now on, e.g. on shutdown
+  void close();
+
+  inline std::size_t capacity() const { return capacity_; }
+  inline std::uint64_t head() const { return head_.load(std::memory_order_acquire); }
+
+protected:
+  // Cursor value of an unused slot
+  static constexpr std::uint64_t free_slot_ = std::numeric_limits<std::uint64_t>::max();
+
+  std::uint64_t min_cursor_() const;
+  void notify_writer_();
+
+  const std::size_t capacity_;
+  const SlowReaderPolicy policy_;
+  std::vector<value_type> buffer_;
+  std::atomic<std::uint64_t> head_;
+  std::atomic<std::uint64_t> reserve_;
+  std::vector<std::atomic<std::uint64_t>> cursors_;
+  std::atomic<bool> closed_;
+
+  // Only used to park a blocked writer
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cv_;
+};
+
+/**
+ * @brief Process-wide registry of named audio rings, so components composed into the same
+ * container can attach readers to one ring instead of subscribing to the same topic again.
+ * The first caller of a name creates the ring, later callers get the existing one (and their
+ * capacity / policy is ignored).  The ring lives as long as someone holds the pointer.
+ */
+std::shared_ptr<BroadcastRing<std::int16_t>> get_audio_bus(
+                  const std::string &name, const std::size_t &capacity,
+                  SlowReaderPolicy policy = SlowReaderPolicy::Overwrite);
+
 /**
  * Implementations -- RingBuffer.cpp
 **/
@@ -200,6 +417,135 @@ void ThreadSafeRing<value_type>::clear() {
   RingBuffer<value_type>::clear();
 }
 
+/**
+ * Implementations -- BroadcastRing.cpp
+**/
+
+template <typename value_type>
+BroadcastRing<value_type>::Reader::Reader(BroadcastRing<value_type> *ring, std::size_t slot)
+    : ring_(ring), slot_(slot), lost_(0) {
+}
+
+template <typename value_type> BroadcastRing<value_type>::Reader::~Reader() {
+  ring_->cursors_[slot_].store(free_slot_, std::memory_order_release);
+  ring_->notify_writer_();
+}
+
+template <typename value_type>
+std::size_t BroadcastRing<value_type>::Reader::available() const {
+  return ring_->head() - ring_->cursors_[slot_].load(std::memory_order_relaxed);
+}
+
+template <typename value_type>
+std::pair<typename BroadcastRing<value_type>::Span, typename BroadcastRing<value_type>::Span>
+BroadcastRing<value_type>::Reader::peek(std::size_t max_count) {
+  const std::uint64_t head = ring_->head();
+  std::uint64_t cursor = ring_->cursors_[slot_].load(std::memory_order_relaxed);
+
+  // Fell behind by more than the capacity: skip what was overwritten
+  if ( head - cursor > ring_->capacity_ ) {
+    lost_ += head - ring_->capacity_ - cursor;
+    cursor = head - ring_->capacity_;
+    ring_->cursors_[slot_].store(cursor, std::memory_order_release);
+  }
+
+  const std::size_t count = std::min<std::uint64_t>(head - cursor, max_count);
+  const std::size_t pos = cursor % ring_->capacity_;
+  const std::size_t first = std::min(count, ring_->capacity_ - pos);
+  return {{ring_->buffer_.data() + pos, first}, {ring_->buffer_.data(), count - first}};
+}
+
+template <typename value_type>
+bool BroadcastRing<value_type>::Reader::consume(std::size_t count) {
+  const std::uint64_t cursor = ring_->cursors_[slot_].load(std::memory_order_relaxed);
+
+  // Under the overwrite policy the writer may have reserved the slots we just read
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t reserve = ring_->reserve_.load(std::memory_order_relaxed);
+  const bool intact = reserve <= cursor + ring_->capacity_;
+
+  ring_->cursors_[slot_].store(cursor + count, std::memory_order_release);
+  ring_->notify_writer_();
+  return intact;
+}
+
+template <typename value_type>
+BroadcastRing<value_type>::BroadcastRing(const std::size_t &capacity, SlowReaderPolicy policy,
+                                         const std::size_t &max_readers)
+    : capacity_(capacity), policy_(policy), buffer_(capacity), head_(0), reserve_(0),
+      cursors_(max_readers), closed_(false) {
+  for (auto &cursor : cursors_) {
+    cursor.store(free_slot_, std::memory_order_relaxed);
+  }
+}
+
+template <typename value_type>
+std::unique_ptr<typename BroadcastRing<value_type>::Reader>
+BroadcastRing<value_type>::register_reader() {
+  for (std::size_t slot = 0; slot < cursors_.size(); ++slot) {
+    std::uint64_t expected = free_slot_;
+    if ( cursors_[slot].compare_exchange_strong(expected, head(), std::memory_order_acq_rel) ) {
+      return std::unique_ptr<Reader>(new Reader(this, slot));
+    }
+  }
+  return nullptr;
+}
+
+template <typename value_type>
+std::uint64_t BroadcastRing<value_type>::min_cursor_() const {
+  std::uint64_t min_cursor = head_.load(std::memory_order_relaxed);
+  for (const auto &cursor : cursors_) {
+    min_cursor = std::min(min_cursor, cursor.load(std::memory_order_acquire));
+  }
+  return min_cursor;
+}
+
+template <typename value_type> void BroadcastRing<value_type>::notify_writer_() {
+  if ( policy_ == SlowReaderPolicy::Block ) {
+    wait_cv_.notify_one();
+  }
+}
+
+template <typename value_type>
+void BroadcastRing<value_type>::write(const value_type *data, std::size_t count) {
+  while ( count > 0 ) {
+    const std::uint64_t head = head_.load(std::memory_order_relaxed);
+    std::size_t chunk = std::min(count, capacity_);
+
+    if ( policy_ == SlowReaderPolicy::Block ) {
+      // Wait until the slowest reader leaves room for at least part of the data
+      std::unique_lock<std::mutex> lock(wait_mutex_);
+      wait_cv_.wait_for(lock, std::chrono::milliseconds(10), [this, head] {
+        return closed_.load(std::memory_order_acquire) || head - min_cursor_() < capacity_;
+      });
+      if ( !closed_.load(std::memory_order_acquire) ) {
+        const std::uint64_t used = head - min_cursor_();
+        if ( used >= capacity_ ) {
+          continue;
+        }
+        chunk = std::min<std::size_t>(chunk, capacity_ - used);
+      }
+    }
+
+    reserve_.store(head + chunk, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const std::size_t pos = head % capacity_;
+    const std::size_t first = std::min(chunk, capacity_ - pos);
+    std::copy(data, data + first, buffer_.begin() + pos);
+    std::copy(data + first, data + chunk, buffer_.begin());
+
+    head_.store(head + chunk, std::memory_order_release);
+    data += chunk;
+    count -= chunk;
+  }
+}
+
+template <typename value_type> void BroadcastRing<value_type>::close() {
+  closed_.store(true, std::memory_order_release);
+  wait_cv_.notify_all();
+}
+
 } // end of namespace whisper
 #endif // WHISPER_UTIL__AUDIO_BUFFERS_HPP_
 
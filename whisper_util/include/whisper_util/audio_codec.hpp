@@ -0,0 +1,54 @@
+#ifndef WHISPER_UTIL__AUDIO_CODEC_HPP_
+#define WHISPER_UTIL__AUDIO_CODEC_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace whisper {
+
+/**
+ * @brief Lossless compression of int16 PCM, along the lines of FLAC's fixed subframes.  Each
+ * channel is predicted by the polynomial predictor (order 0 to 4) that leaves the smallest
+ * residual, the residual is Rice coded in partitions of partition_size samples with their own
+ * Rice parameter.  Speech and pauses compress well, channels that would grow (noise) are stored
+ * verbatim instead.
+ *
+ * Bitstream, MSB first, channel after channel, each padded to whole bytes:
+ *   3 bits order, order x 16 bits warm-up samples,
+ *   per partition: 5 bits Rice parameter k, then per residual the zig-zag value u as
+ *   u >> k zeros, a one and the lowest k bits of u.
+ *   Order 7 is followed by all samples as 16 bits each.
+ * The frame count and the number of channels are not part of the stream.
+ *
+ * The predictor search uses AVX2, SSE2 or NEON when the compiler targets them.  Decoding is
+ * scalar, the position of a Rice code is only known once the one before it is read and every
+ * sample is predicted from the ones before it.  The encoder keeps scratch memory between calls
+ * and is **not** thread-safe.
+ */
+class AudioEncoder {
+public:
+  static constexpr std::size_t max_order = 4;
+  static constexpr std::size_t partition_size = 256;
+
+  // Compress frames frames of interleaved audio and append them to out.
+  //     :return: The number of bytes appended
+  std::size_t encode(const std::int16_t *in, std::size_t frames, std::size_t channels,
+                     std::vector<std::uint8_t> &out);
+
+protected:
+  std::vector<std::int32_t> channel_;
+};
+
+// Decompress frames frames of interleaved audio written by AudioEncoder into out.
+//     :return: false if data is corrupt or too short, out is undefined then
+bool decode_audio(const std::uint8_t *data, std::size_t size, std::size_t frames,
+                  std::size_t channels, std::int16_t *out);
+
+// Sum of absolute residuals for every predictor order over x[max_order, n)
+std::array<std::uint64_t, AudioEncoder::max_order + 1>
+fixed_residual_sums(const std::int32_t *x, std::size_t n);
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__AUDIO_CODEC_HPP_
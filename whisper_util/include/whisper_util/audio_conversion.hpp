@@ -0,0 +1,19 @@
+#ifndef WHISPER_UTIL__AUDIO_CONVERSION_HPP_
+#define WHISPER_UTIL__AUDIO_CONVERSION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace whisper {
+
+/**
+ * @brief Convert int16 PCM samples to float samples in [-1, 1], scaled by 1 / INT16_MAX.
+ * Uses AVX2, SSE2 or NEON when the compiler targets them and falls back to a scalar loop.
+ *
+ * @param src  n input samples
+ * @param dst  n output samples, must not overlap src
+ */
+void int16_to_float(const std::int16_t *src, float *dst, std::size_t n);
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__AUDIO_CONVERSION_HPP_
@@ -0,0 +1,112 @@
+#ifndef WHISPER_UTIL__AUDIO_SOURCES_HPP_
+#define WHISPER_UTIL__AUDIO_SOURCES_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace whisper {
+
+/**
+ * @brief Interleaved int16 audio from somewhere other than a sound card.  Sources are **not**
+ * thread-safe, a single thread is expected to read them.
+ */
+class AudioSourceBackend {
+public:
+  virtual ~AudioSourceBackend() = default;
+
+  // Read up to frames frames (one sample per channel each) into out.
+  //     :return: The number of frames read, may be less than frames (or 0) before done()
+  virtual std::size_t read(std::int16_t *out, std::size_t frames) = 0;
+
+  // No more audio will come
+  virtual bool done() const = 0;
+
+  // Live sources deliver audio as it is produced, they are neither paced nor stamped on their
+  //    own timeline
+  virtual bool live() const { return false; }
+
+  inline std::uint32_t sample_rate() const { return sample_rate_; }
+  inline std::uint16_t channels() const { return channels_; }
+
+protected:
+  AudioSourceBackend(std::uint32_t sample_rate, std::uint16_t channels)
+      : sample_rate_(sample_rate), channels_(channels) {}
+
+  std::uint32_t sample_rate_;
+  std::uint16_t channels_;
+};
+
+/**
+ * @brief 16 bit PCM WAV files (format from the header) or headerless raw files (format as given).
+ * Samples are expected in little-endian byte order.
+ */
+class FileSource : public AudioSourceBackend {
+public:
+  FileSource(const std::string &path, std::uint32_t sample_rate, std::uint16_t channels,
+             bool loop = false);
+
+  std::size_t read(std::int16_t *out, std::size_t frames) override;
+  inline bool done() const override { return done_; }
+
+protected:
+  // Parse the RIFF header, leaves the stream at the first sample
+  void read_wav_header_(const std::string &path);
+
+  std::ifstream file_;
+  std::streampos data_start_;
+  std::uint64_t data_frames_;  // frames in the file
+  std::uint64_t position_;     // frames read since data_start_
+  bool loop_;
+  bool done_;
+};
+
+/**
+ * @brief Raw little-endian int16 audio from a named pipe, or stdin for path "-".  Reads wait at
+ * most timeout_ms, so the reading thread can be stopped while the writer is quiet.
+ */
+class PipeSource : public AudioSourceBackend {
+public:
+  PipeSource(const std::string &path, std::uint32_t sample_rate, std::uint16_t channels,
+             int timeout_ms = 100);
+  ~PipeSource() override;
+
+  std::size_t read(std::int16_t *out, std::size_t frames) override;
+  inline bool done() const override { return done_; }
+  inline bool live() const override { return true; }
+
+protected:
+  int fd_;
+  bool owns_fd_;
+  int timeout_ms_;
+  bool done_;
+  // Bytes of a frame that was only partially read
+  std::vector<char> partial_;
+};
+
+/**
+ * @brief An endless sine tone or white noise, the same on all channels.
+ */
+class SyntheticSource : public AudioSourceBackend {
+public:
+  enum class Waveform {Tone, Noise};
+
+  SyntheticSource(Waveform waveform, std::uint32_t sample_rate, std::uint16_t channels,
+                  double frequency = 440., double amplitude = 0.1);
+
+  std::size_t read(std::int16_t *out, std::size_t frames) override;
+  inline bool done() const override { return false; }
+
+protected:
+  Waveform waveform_;
+  double phase_step_;
+  double phase_;
+  double amplitude_;
+  std::minstd_rand random_;
+  std::uniform_real_distribution<double> noise_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__AUDIO_SOURCES_HPP_
@@ -0,0 +1,41 @@
+#ifndef WHISPER_UTIL__DRIFT_ESTIMATOR_HPP_
+#define WHISPER_UTIL__DRIFT_ESTIMATOR_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace whisper {
+
+/**
+ * @brief Estimates how the sample clock of an audio source drifts against the local clock.
+ * Each observation pairs an absolute sample index with the (local) time that sample was
+ * captured.  A least-squares line through the last window_size observations gives the
+ * local time any sample index corresponds to, and the skew of the sample clock
+ * (e.g. +20e-6 if the source runs 20 ppm slow compared to its nominal rate).
+ * This estimator is **not** thread-safe.
+ */
+class DriftEstimator {
+public:
+  DriftEstimator(const std::size_t &window_size);
+
+  void add(const std::uint64_t &sample_index, std::chrono::system_clock::time_point stamp);
+
+  // Fit the window and evaluate it at sample_index.
+  //     :return: false if there are not enough observations yet
+  bool estimate(const std::uint64_t &sample_index,
+                std::chrono::system_clock::time_point &expected, double &skew) const;
+
+  void clear();
+
+  inline std::size_t size() const { return observations_.size(); }
+
+protected:
+  const std::size_t window_size_;
+  // (sample index, nanoseconds since epoch)
+  std::deque<std::pair<std::uint64_t, std::int64_t>> observations_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__DRIFT_ESTIMATOR_HPP_
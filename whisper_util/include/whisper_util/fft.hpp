@@ -0,0 +1,37 @@
+#ifndef WHISPER_UTIL__FFT_HPP_
+#define WHISPER_UTIL__FFT_HPP_
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace whisper {
+
+/**
+ * @brief A precomputed FFT of a fixed size n = 2^k * m.  Radix-2 stages split the input down
+ * to m points, which are transformed by a direct DFT, so sizes like whisper's 400 (16 * 25) do
+ * not need padding.  The plan keeps scratch buffers and is **not** thread-safe.
+ */
+class FftPlan {
+public:
+  FftPlan(const std::size_t &size);
+
+  // Power spectrum |X[k]|^2 for k = 0 .. size / 2 of size real input samples
+  void power_spectrum(const float *input, float *output);
+
+  inline std::size_t size() const { return size_; }
+  inline std::size_t bins() const { return size_ / 2 + 1; }
+
+protected:
+  void transform_(const std::complex<float> *input, std::size_t stride,
+                  std::complex<float> *output, std::size_t size);
+
+  const std::size_t size_;
+  // exp(-2 pi i k / size_)
+  std::vector<std::complex<float>> twiddles_;
+  std::vector<std::complex<float>> input_;
+  std::vector<std::complex<float>> output_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__FFT_HPP_
@@ -0,0 +1,78 @@
+#ifndef WHISPER_UTIL__JITTER_BUFFER_HPP_
+#define WHISPER_UTIL__JITTER_BUFFER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace whisper {
+
+/**
+ * @brief Reorders sequence-numbered audio chunks that arrive late or out of order. A chunk is
+ * released as soon as it is the next one in sequence.  If a chunk is missing, the chunks after
+ * it are held back for at most latency (or until max_chunks are waiting), then the missing ones
+ * are declared lost and the stream continues.  The source restarted if a chunk is more than
+ * max_chunks behind the stream, is behind it but captured after the last chunk played out, or
+ * its stamp jumps back or more than restart_gap ahead.  The buffer then starts over at that
+ * chunk and pop() reports the restart.  This buffer is **not** thread-safe.
+ */
+class JitterBuffer {
+public:
+  struct Chunk {
+    std::uint64_t sequence;
+    std::chrono::system_clock::time_point stamp;  // capture time of the first sample
+    std::uint32_t sample_rate;
+    std::uint16_t channels;
+    std::vector<std::int16_t> data;               // interleaved samples
+  };
+
+  JitterBuffer(const std::chrono::milliseconds &latency, const std::size_t &max_chunks = 64,
+               const std::chrono::milliseconds &restart_gap = std::chrono::seconds(2));
+
+  // Add a chunk that arrived at arrival.
+  //     :return: false if the chunk was dropped because it is a duplicate or came too late
+  bool push(Chunk &&chunk, std::chrono::system_clock::time_point arrival);
+
+  // Accept a chunk without buffering it, if it is the next one in sequence and nothing is
+  //    waiting.  Saves the copy into a Chunk for audio that arrives in order.
+  //     :return: true if the caller may play out the chunk right away, otherwise push it
+  bool pass(const std::uint64_t &sequence, std::chrono::system_clock::time_point stamp);
+
+  // Take the next chunk that is ready to be played out.
+  //     :param restarted: Set to whether out is the first chunk after the source restarted
+  //     :return: The number of chunks lost right before out, or -1 if no chunk is ready
+  long pop(Chunk &out, std::chrono::system_clock::time_point now, bool *restarted = nullptr);
+
+  void clear();
+
+  inline std::size_t size() const { return pending_.size(); }
+  inline std::uint64_t late_chunks() const { return late_chunks_; }
+  inline std::uint64_t lost_chunks() const { return lost_chunks_; }
+
+protected:
+  struct Pending {
+    Chunk chunk;
+    std::chrono::system_clock::time_point arrival;
+  };
+
+  const std::chrono::milliseconds latency_;
+  const std::size_t max_chunks_;
+  const std::chrono::milliseconds restart_gap_;
+  std::map<std::uint64_t, Pending> pending_;
+  bool started_;
+  bool restarted_;
+  std::uint64_t next_sequence_;
+  std::chrono::system_clock::time_point last_stamp_;  // of the last chunk played out
+
+  // Whether chunk belongs to a new stream of a restarted source
+  bool is_restart_(const std::uint64_t &sequence,
+                   std::chrono::system_clock::time_point stamp) const;
+
+  std::uint64_t late_chunks_;
+  std::uint64_t lost_chunks_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__JITTER_BUFFER_HPP_
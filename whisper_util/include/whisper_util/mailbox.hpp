@@ -0,0 +1,79 @@
+#ifndef WHISPER_UTIL__MAILBOX_HPP_
+#define WHISPER_UTIL__MAILBOX_HPP_
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+namespace whisper {
+
+/**
+ * @brief Hands work from a producer to a consumer thread, keeping only the latest item.  An item
+ * the consumer has not taken yet is replaced by the next post, so a slow consumer always works
+ * on the newest data instead of a growing backlog.
+ *
+ * Items are swapped in and out rather than copied.  The consumer's previous item goes back into
+ * the slot and returns to the producer with its next post, so buffers inside value_type are
+ * reused without allocating.
+ *
+ * @tparam value_type
+ */
+template <typename value_type> class Mailbox {
+public:
+  Mailbox();
+
+  // Swap value into the slot, value receives the slot's previous content.
+  //     :return: true if that was an item the consumer never took
+  bool post(value_type &value);
+
+  // Block until an item is posted and swap it into value.
+  //     :return: false once the mailbox is closed
+  bool take(value_type &value);
+
+  // Wake up and refuse all waiting and future takes
+  void close();
+
+protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  value_type slot_;
+  bool full_;
+  bool closed_;
+};
+
+template <typename value_type>
+Mailbox<value_type>::Mailbox() : full_(false), closed_(false) {}
+
+template <typename value_type> bool Mailbox<value_type>::post(value_type &value) {
+  bool replaced;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(slot_, value);
+    replaced = full_;
+    full_ = true;
+  }
+  cv_.notify_one();
+  return replaced;
+}
+
+template <typename value_type> bool Mailbox<value_type>::take(value_type &value) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return full_ || closed_; });
+  if ( closed_ ) {
+    return false;
+  }
+  std::swap(slot_, value);
+  full_ = false;
+  return true;
+}
+
+template <typename value_type> void Mailbox<value_type>::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__MAILBOX_HPP_
@@ -0,0 +1,95 @@
+#ifndef WHISPER_UTIL__MEL_SPECTROGRAM_HPP_
+#define WHISPER_UTIL__MEL_SPECTROGRAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "whisper.h"
+
+#include "whisper_util/fft.hpp"
+
+namespace whisper {
+
+/**
+ * @brief A log-mel spectrogram in whisper's layout: n_mels rows of n_len frames (10 ms each).
+ * The first n_len_org frames are audio, the rest is silence padding.
+ */
+struct MelSpectrogram {
+  std::vector<float> data;
+  std::size_t n_mels = 0;
+  std::size_t n_len = 0;
+  std::size_t n_len_org = 0;
+};
+
+// Slaney-style mel filterbank (librosa.filters.mel with its defaults), which whisper's models
+//    were trained with.  n_mels rows of n_fft / 2 + 1 weights.
+std::vector<float> mel_filters(std::size_t n_mels, std::size_t n_fft = WHISPER_N_FFT,
+                               std::size_t sample_rate = WHISPER_SAMPLE_RATE);
+
+/**
+ * @brief Rolling log-mel spectrogram of the audio in an AudioRing, so inference does not have to
+ * redo the STFT of the whole window every tick.  Frames are computed once, as samples arrive,
+ * with whisper's front end: 400 point Hann windowed power spectra every 160 samples (frame f is
+ * centered on sample f * 160), mel filtered and log10'd.  The normalization depends on the
+ * whole window and is applied by peak_into.
+ *
+ * Uses the same absolute sample indices as AudioRing.  Guarded by a mutex, enqueue is meant for
+ * the audio thread and peak_into for any other.
+ */
+class MelRing {
+public:
+  MelRing(const std::size_t &capacity, const std::size_t &n_mels);
+
+  // Add count samples of 16 kHz mono audio that start at the absolute index first_sample.
+  //    Samples skipped since the last call count as silence.
+  void enqueue(const std::int16_t *data, std::size_t count, std::uint64_t first_sample);
+
+  // Whisper's normalized spectrogram of the frames centered in [from_sample, to_sample) that are
+  //    still in the ring, followed by WHISPER_CHUNK_SIZE seconds of silence.  out is only
+  //    reallocated when it has to grow.
+  //    :return: The absolute index of the sample frame 0 is centered on
+  std::uint64_t peak_into(MelSpectrogram &out, std::uint64_t from_sample,
+                          std::uint64_t to_sample) const;
+
+  // Change the capacity (in samples), keeping the newest frames
+  void resize(const std::size_t &capacity);
+
+  static constexpr std::size_t hop_length = WHISPER_HOP_LENGTH;
+  static constexpr std::size_t n_fft = WHISPER_N_FFT;
+
+protected:
+  // Forget everything, the next frame is the first one fully after first_sample
+  void reset_(std::uint64_t first_sample);
+  // Compute frame next_frame_ from samples_
+  void add_frame_();
+
+  const std::size_t n_mels_;
+  // Per mel band the weights of its (few) non-zero bins
+  std::vector<std::size_t> band_start_;
+  std::vector<std::vector<float>> band_weights_;
+
+  FftPlan fft_;
+  std::vector<float> window_;
+  std::vector<float> frame_;
+  std::vector<float> power_;
+
+  // Audio not fully framed yet, samples_[0] is the absolute sample samples_start_
+  std::vector<float> samples_;
+  std::uint64_t samples_start_;
+  std::uint64_t samples_written_;
+
+  // log10 mel energies, frame f lives at frames_[(f % capacity_frames_) * n_mels_].  Frames
+  //    [first_frame_, next_frame_) exist, at most capacity_frames_ of them are kept.
+  std::size_t capacity_frames_;
+  std::vector<float> frames_;
+  std::uint64_t first_frame_;
+  std::uint64_t next_frame_;
+  bool started_;
+
+  mutable std::mutex mutex_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__MEL_SPECTROGRAM_HPP_
@@ -0,0 +1,55 @@
+#ifndef WHISPER_UTIL__RESAMPLER_HPP_
+#define WHISPER_UTIL__RESAMPLER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "whisper.h"
+
+namespace whisper {
+
+/**
+ * @brief Converts interleaved int16 audio of any rate and channel count to mono int16 at
+ * output_rate (whisper's 16 kHz by default).  Channels are averaged, then a polyphase FIR
+ * (Kaiser-windowed sinc) resamples by the rational factor output_rate / input_rate, e.g.
+ * 1/3 for 48 kHz or 160/441 for 44.1 kHz.  Filter state is kept between calls, so a stream can
+ * be fed chunk by chunk.  This resampler is **not** thread-safe.
+ */
+class Resampler {
+public:
+  Resampler(const std::size_t &input_rate, const std::size_t &channels = 1,
+            const std::size_t &output_rate = WHISPER_SAMPLE_RATE,
+            const std::size_t &taps_per_phase = 32);
+
+  // Downmix and resample frames interleaved frames, the result is appended to out
+  void process(const std::int16_t *interleaved, std::size_t frames,
+               std::vector<std::int16_t> &out);
+
+  void reset();
+
+  // Mono at the output rate, process() only copies
+  inline bool is_passthrough() const { return channels_ == 1 && up_ == down_; }
+  inline std::size_t input_rate() const { return input_rate_; }
+  inline std::size_t channels() const { return channels_; }
+
+protected:
+  const std::size_t input_rate_;
+  const std::size_t channels_;
+  const std::size_t taps_;
+
+  // Interpolate by up_, decimate by down_
+  std::size_t up_;
+  std::size_t down_;
+
+  // One filter per phase, taps reversed so each output is a contiguous dot product
+  std::vector<float> coefficients_;
+
+  // Mono input, starting with taps_ - 1 samples of history
+  std::vector<float> history_;
+  // Position of the next output in the upsampled domain, relative to history_[0]
+  std::size_t next_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__RESAMPLER_HPP_
@@ -0,0 +1,59 @@
+#ifndef WHISPER_UTIL__VAD_HPP_
+#define WHISPER_UTIL__VAD_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "whisper_util/fft.hpp"
+
+namespace whisper {
+
+/**
+ * @brief Cheap summary of a short block of audio, used for voice activity detection.
+ */
+struct AudioBlock {
+  float rms;                 // root mean square, relative to full scale
+  float zero_crossing_rate;  // sign changes per sample, in [0, 1]
+  float spectral_flux;       // positive change of the magnitude spectrum, 0 if not computed
+};
+
+/**
+ * @brief Thresholds a block has to pass to count as speech.  A min_spectral_flux of 0 ignores
+ * the spectral flux.
+ */
+struct VadThresholds {
+  float min_rms;
+  float max_zero_crossing_rate;
+  float min_spectral_flux;
+};
+
+// Compute rms and zero crossing rate of count samples, spectral_flux is left at 0
+AudioBlock summarize_block(const std::int16_t *data, std::size_t count);
+
+bool is_speech(const AudioBlock &block, const VadThresholds &thresholds);
+
+// Signal to noise ratio of a stretch of blocks in dB, estimated from the rms of its loud (90th
+//    percentile) and its quiet (10th percentile) blocks.  scratch avoids allocating.
+float snr_db(const std::vector<AudioBlock> &blocks, std::vector<float> &scratch);
+
+/**
+ * @brief Spectral flux of consecutive blocks, i.e. how much the (Hann-windowed) magnitude
+ * spectrum rose compared to the previous block.  **Not** thread-safe.
+ */
+class SpectralFlux {
+public:
+  SpectralFlux(const std::size_t &block_size);
+
+  float operator()(const std::int16_t *data);
+
+protected:
+  FftPlan fft_;
+  std::vector<float> window_;
+  std::vector<float> input_;
+  std::vector<float> magnitude_;
+  std::vector<float> previous_;
+};
+
+} // end of namespace whisper
+#endif // WHISPER_UTIL__VAD_HPP_
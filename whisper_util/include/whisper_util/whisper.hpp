@@ -1,13 +1,49 @@
 #ifndef WHISPER_UTIL__WHISPER_HPP_
 #define WHISPER_UTIL__WHISPER_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "whisper.h"
 
+#include "whisper_util/mel_spectrogram.hpp"
+
 namespace whisper {
+
+/**
+ * @brief Process-wide cache of loaded models, so every Whisper in the process (e.g. inference
+ * nodes composed into one container) shares a single copy of the weights.  Keyed by model path
+ * and the GPU settings, the model is freed once the last holder is gone.
+ */
+std::shared_ptr<whisper_context> get_model_context(const std::string &model_path,
+                                                   const whisper_context_params &cparams);
+
+// True if a phrase of up to max_length tokens repeats at least min_repeats times in a row, the
+//    typical failure of a decoder that ran out of audio context
+bool has_repetition(const std::vector<whisper_token> &tokens, std::size_t max_length = 4,
+                    std::size_t min_repeats = 4);
+
+/**
+ * @brief When to give up on a forward call.  whisper checks it through its abort_callback between
+ * graph computations, so an abort takes effect within milliseconds on the CPU backend.
+ */
+struct Deadline {
+  std::chrono::steady_clock::time_point time = std::chrono::steady_clock::time_point::max();
+  // Optionally also give up once *latest passes generation, i.e. newer input is waiting
+  const std::atomic<std::uint64_t> *latest = nullptr;
+  std::uint64_t generation = 0;
+
+  bool expired() const;
+};
+
 class Whisper {
 public:
   Whisper();
@@ -16,21 +52,106 @@ public:
 
   void initialize(const std::string &model_path);
   std::string forward(const std::vector<float> &input);
+  // Tokens of the last forward call
   std::vector<whisper_token> tokens();
+  // Change wparams.n_threads while other threads may be running forward calls
+  void set_n_threads(int n_threads);
+
+  // Called from within a forward_serialize call each time whisper's running hypothesis
+  //    completes a segment, while it keeps decoding the rest.  The output vectors then hold the
+  //    hypothesis so far, which the final result may still revise.  Not during a pass with a
+  //    shortened audio_ctx, whose result may still be rejected.
+  using SegmentCallback = std::function<void()>;
 
-  // Run whisper forword on input and serialize the result into WhisperTokens.msg fields
-  void forward_serialize(
+  // Run whisper forword on input and serialize the result into WhisperTokens.msg fields, which
+  //    are expected to be empty.  prompt is text decoded ahead of the input (e.g. the transcript
+  //    of the audio before it), whisper keeps at most half its text context of it.  speech tells
+  //    whether the input is known to contain speech, see audio_ctx_granularity.
+  //    Thread-safe, concurrent calls each decode with their own state from the pool.
+  //    :return: false if whisper failed or the deadline expired, nothing is serialized then
+  bool forward_serialize(
                   const std::vector<float> &input,
                   std::vector<int> &token_ids,
                   std::vector<std::string> &token_texts,
                   std::vector<float> &token_probs,
                   std::vector<int> &segment_start_token_idx,
                   std::vector<int64_t> &segment_start_timestamp,
-                  std::vector<int64_t> &segment_end_timestamp);
+                  std::vector<int64_t> &segment_end_timestamp,
+                  const Deadline &deadline = Deadline(),
+                  const SegmentCallback &on_segment = SegmentCallback(),
+                  const std::vector<whisper_token> &prompt = std::vector<whisper_token>(),
+                  bool speech = true);
+
+  // Same on a precomputed log-mel spectrogram (e.g. from a MelRing), skips whisper's front end
+  bool forward_serialize(
+                  const MelSpectrogram &mel,
+                  std::vector<int> &token_ids,
+                  std::vector<std::string> &token_texts,
+                  std::vector<float> &token_probs,
+                  std::vector<int> &segment_start_token_idx,
+                  std::vector<int64_t> &segment_start_timestamp,
+                  std::vector<int64_t> &segment_end_timestamp,
+                  const Deadline &deadline = Deadline(),
+                  const SegmentCallback &on_segment = SegmentCallback(),
+                  const std::vector<whisper_token> &prompt = std::vector<whisper_token>(),
+                  bool speech = true);
 
   whisper_context *ctx;
+  // Only to be modified before the first forward call
   whisper_full_params wparams;
   whisper_context_params cparams;
+
+  // Encode only as many frames (20 ms each) as the input needs plus audio_ctx_margin, rounded up
+  //    to audio_ctx_granularity, instead of the full 30 s.  0 disables.  Results that come out
+  //    repetitive (or empty, for input with speech) are decoded again with the full context.
+  int audio_ctx_granularity;
+  int audio_ctx_margin;
+  std::atomic<std::uint64_t> audio_ctx_fallbacks;
+
+protected:
+  // The output vectors of a forward_serialize call
+  struct Serialized {
+    std::vector<int> &token_ids;
+    std::vector<std::string> &token_texts;
+    std::vector<float> &token_probs;
+    std::vector<int> &segment_start_token_idx;
+    std::vector<int64_t> &segment_start_timestamp;
+    std::vector<int64_t> &segment_end_timestamp;
+
+    void clear();
+  };
+
+  // whisper_full on state, with the encoder context sized to window_samples.  Without samples
+  //    it decodes the first window_samples of the spectrogram set on state.  With on_segment,
+  //    the hypothesis is serialized into out whenever it completes a segment.
+  int full_(whisper_state *state, const float *samples, std::size_t n_samples,
+            std::size_t window_samples, const Deadline &deadline = Deadline(),
+            Serialized *out = nullptr, const SegmentCallback &on_segment = SegmentCallback(),
+            const std::vector<whisper_token> &prompt = std::vector<whisper_token>(),
+            bool speech = true);
+  // Append the segments of state to out
+  void serialize_(whisper_state *state, Serialized &out);
+  // The segments of state followed by the completed segments of tokens, a decoder's sequence
+  //    in the seek window after them.  offset is the start of the first seek window (10 ms).
+  void serialize_hypothesis_(whisper_state *state, const whisper_token_data *tokens,
+                             int n_tokens, std::int64_t offset, Serialized &out);
+  int audio_ctx_for_(std::size_t samples) const;
+  // Repetitive, or empty although there was speech
+  bool is_degenerate_(whisper_state *state, bool speech) const;
+
+  // Decoder states (KV cache, results) are per call, created on demand and reused.  The pool
+  //    grows to the number of concurrent calls.
+  whisper_state *acquire_state_();
+  void release_state_(whisper_state *state);
+  void free_states_();
+
+  std::shared_ptr<whisper_context> model_;
+  std::mutex pool_mutex_;
+  std::vector<whisper_state *> states_;
+  std::vector<whisper_state *> idle_states_;
+  // Copied before the state goes back into the pool, where the next call may overwrite it
+  std::vector<whisper_token> last_tokens_;
+  std::mutex wparams_mutex_;
 };
 } // end of namespace whisper
 #endif // WHISPER_UTIL__WHISPER_HPP_
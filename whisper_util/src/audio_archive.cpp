@@ -0,0 +1,249 @@
+#include "whisper_util/audio_archive.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "whisper_util/audio_buffers.hpp"
+#include "whisper_util/audio_conversion.hpp"
+
+namespace whisper {
+
+namespace {
+// Stamps closer than this to where the stream is expected to continue are not a jump
+constexpr std::int64_t jump_tolerance_ns = 1000000;
+} // end of anonymous namespace
+
+AudioArchive::AudioArchive(const std::string &directory,
+                           const std::chrono::seconds &segment_length,
+                           const std::size_t &max_segments,
+                           const std::chrono::milliseconds &index_interval)
+    : directory_(directory), segment_samples_(segment_length.count() * WHISPER_SAMPLE_RATE),
+      max_segments_(std::max<std::size_t>(max_segments, 1)),
+      index_interval_(std::max<std::size_t>(time_to_count(index_interval), 1)),
+      written_(0), next_time_ns_(0) {
+  if ( segment_samples_ == 0 ) {
+    throw std::invalid_argument("Archive segments must be at least one second long.");
+  }
+  std::filesystem::create_directories(directory_);
+
+  // Segments of earlier runs count towards max_segments, oldest first
+  std::vector<std::pair<std::int64_t, std::string>> previous;
+  for (const auto &entry : std::filesystem::directory_iterator(directory_)) {
+    const std::string name = entry.path().filename().string();
+    if ( name.rfind("segment_", 0) != 0 || entry.path().extension() != ".pcm" ) {
+      continue;
+    }
+    try {
+      previous.emplace_back(std::stoll(name.substr(8)), entry.path().string());
+    } catch ( const std::exception & ) {
+      // Not one of ours
+    }
+  }
+  std::sort(previous.begin(), previous.end());
+  for (auto &file : previous) {
+    previous_.push_back(std::move(file.second));
+  }
+  while ( previous_.size() >= max_segments_ ) {
+    std::filesystem::remove(previous_.front());
+    previous_.pop_front();
+  }
+}
+
+AudioArchive::~AudioArchive() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &segment : segments_) {
+    close_segment_(segment, false);
+  }
+}
+
+void AudioArchive::append(const std::int16_t *data, std::size_t count,
+                          std::chrono::system_clock::time_point stamp) {
+  if ( count == 0 ) {
+    return;
+  }
+  std::int64_t stamp_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(stamp.time_since_epoch()).count();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // The index has to stay sorted by time.  Stamps that step back (a clock jump or drift slew)
+  //    are not indexed, the audio is archived as continuing the stream until they catch up.
+  if ( !index_.empty() && stamp_ns < next_time_ns_ - jump_tolerance_ns ) {
+    stamp_ns = next_time_ns_;
+  }
+
+  // Index the first sample of this chunk if the stream jumped or the last entry is far enough
+  //    back.  Taking the stamp here also follows timestamps that are slewed for clock drift.
+  const bool jump = std::llabs(stamp_ns - next_time_ns_) > jump_tolerance_ns;
+  if ( index_.empty() || jump || written_ - index_.back().sample >= index_interval_ ) {
+    if ( !index_.empty() && index_.back().sample == written_ ) {
+      index_.back().time_ns = stamp_ns;
+    } else {
+      index_.push_back({stamp_ns, written_});
+    }
+  }
+  next_time_ns_ = stamp_ns + count_to_time_ns(count).count();
+
+  while ( count > 0 ) {
+    if ( segments_.empty() || written_ - segments_.back().first_sample == segment_samples_ ) {
+      open_segment_();
+    }
+    Segment &segment = segments_.back();
+    const std::size_t offset = written_ - segment.first_sample;
+    const std::size_t n = std::min(count, segment_samples_ - offset);
+    std::memcpy(segment.data + offset, data, n * sizeof(std::int16_t));
+    data += n;
+    count -= n;
+    written_ += n;
+  }
+}
+
+std::chrono::system_clock::time_point AudioArchive::read(
+                                          std::chrono::system_clock::time_point start,
+                                          std::chrono::system_clock::time_point end,
+                                          std::vector<float> &out) const {
+  out.clear();
+  // Only copy the samples while append() has to wait, convert them afterwards
+  std::vector<std::int16_t> raw;
+  std::int64_t first_ns;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if ( index_.empty() || end <= start ) {
+      return start;
+    }
+
+    const std::uint64_t first = locate_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          start.time_since_epoch()).count());
+    const std::uint64_t last = locate_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          end.time_since_epoch()).count());
+    if ( last <= first ) {
+      return start;
+    }
+
+    // Segments are contiguous, so the one holding a sample follows from its offset
+    raw.resize(last - first);
+    const std::uint64_t oldest = segments_.front().first_sample;
+    for (std::uint64_t sample = first; sample < last;) {
+      const Segment &segment = segments_[(sample - oldest) / segment_samples_];
+      const std::size_t offset = sample - segment.first_sample;
+      const std::size_t n = std::min<std::uint64_t>(last - sample, segment_samples_ - offset);
+      std::memcpy(raw.data() + (sample - first), segment.data + offset,
+                  n * sizeof(std::int16_t));
+      sample += n;
+    }
+    first_ns = time_of_(first);
+  }
+
+  out.resize(raw.size());
+  int16_to_float(raw.data(), out.data(), raw.size());
+  return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::nanoseconds(first_ns)));
+}
+
+std::chrono::system_clock::time_point AudioArchive::oldest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if ( index_.empty() ) {
+    return {};
+  }
+  return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::nanoseconds(time_of_(segments_.front().first_sample))));
+}
+
+std::chrono::system_clock::time_point AudioArchive::newest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if ( index_.empty() ) {
+    return {};
+  }
+  return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::nanoseconds(next_time_ns_)));
+}
+
+void AudioArchive::open_segment_() {
+  if ( !previous_.empty() && segments_.size() + previous_.size() >= max_segments_ ) {
+    std::filesystem::remove(previous_.front());
+    previous_.pop_front();
+  } else if ( segments_.size() >= max_segments_ ) {
+    close_segment_(segments_.front(), true);
+    segments_.pop_front();
+    // Keep the entry that maps the start of the (new) oldest segment
+    while ( index_.size() > 1 && index_[1].sample <= segments_.front().first_sample ) {
+      index_.pop_front();
+    }
+  }
+
+  Segment segment;
+  segment.first_sample = written_;
+  const std::int64_t stamp_ms = time_of_(written_) / 1000000;
+  segment.path = (std::filesystem::path(directory_) /
+                  ("segment_" + std::to_string(stamp_ms) + ".pcm")).string();
+  segment.fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if ( segment.fd < 0 ) {
+    throw std::runtime_error("Failed to open " + segment.path + ": " + std::strerror(errno));
+  }
+  const std::size_t bytes = segment_samples_ * sizeof(std::int16_t);
+  if ( ::ftruncate(segment.fd, bytes) != 0 ) {
+    const std::string err = std::strerror(errno);
+    ::close(segment.fd);
+    throw std::runtime_error("Failed to allocate " + segment.path + ": " + err);
+  }
+  void *data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+  if ( data == MAP_FAILED ) {
+    const std::string err = std::strerror(errno);
+    ::close(segment.fd);
+    throw std::runtime_error("Failed to map " + segment.path + ": " + err);
+  }
+  segment.data = static_cast<std::int16_t *>(data);
+  segments_.push_back(segment);
+}
+
+void AudioArchive::close_segment_(Segment &segment, bool remove) {
+  ::munmap(segment.data, segment_samples_ * sizeof(std::int16_t));
+  if ( remove ) {
+    ::unlink(segment.path.c_str());
+  } else {
+    const std::size_t samples = std::min<std::uint64_t>(written_ - segment.first_sample,
+                                                        segment_samples_);
+    if ( ::ftruncate(segment.fd, samples * sizeof(std::int16_t)) != 0 ) {
+      // Only the unused tail stays allocated, the audio is intact
+    }
+  }
+  ::close(segment.fd);
+}
+
+std::uint64_t AudioArchive::locate_(std::int64_t time_ns) const {
+  // Last index entry at or before time_ns, the stream is continuous up to the next entry
+  auto next = std::upper_bound(index_.begin(), index_.end(), time_ns,
+                  [](std::int64_t t, const IndexEntry &entry) { return t < entry.time_ns; });
+  std::uint64_t sample;
+  if ( next == index_.begin() ) {
+    sample = next->sample;
+  } else {
+    const IndexEntry &entry = *std::prev(next);
+    sample = entry.sample + time_to_count_ns(std::chrono::nanoseconds(time_ns - entry.time_ns));
+    sample = std::min(sample, next == index_.end() ? written_ : next->sample);
+  }
+  return std::max(sample, segments_.front().first_sample);
+}
+
+std::int64_t AudioArchive::time_of_(std::uint64_t sample) const {
+  // Last index entry at or before sample
+  auto next = std::upper_bound(index_.begin(), index_.end(), sample,
+                  [](std::uint64_t s, const IndexEntry &entry) { return s < entry.sample; });
+  const IndexEntry &entry = next == index_.begin() ? *next : *std::prev(next);
+  if ( sample < entry.sample ) {
+    return entry.time_ns - count_to_time_ns(entry.sample - sample).count();
+  }
+  return entry.time_ns + count_to_time_ns(sample - entry.sample).count();
+}
+
+} // end of namespace whisper
@@ -1,79 +1,287 @@
 #include "whisper_util/audio_buffers.hpp"
 
+#include <map>
+
 namespace whisper {
 
+AudioRing::Storage::Storage(const std::size_t &capacity, const std::uint64_t &first_valid)
+    : capacity(capacity), size(capacity + WHISPER_SAMPLE_RATE), first_valid(first_valid),
+      samples(size, 0), blocks(size / block_size + 1) {
+}
+
 AudioRing::AudioRing(const std::chrono::milliseconds &buffer_capacity,
                       std::chrono::system_clock::time_point cur_time)
-                                : ThreadSafeRing<std::int16_t>(time_to_count(buffer_capacity)),
-                                time_inc_(count_to_time_ns(1)), audio_start_set(true) {
+                                : origin_ns_(0), audio_start_set_(true),
+                                storage_(std::make_shared<Storage>(
+                                            time_to_count(buffer_capacity), 0)),
+                                capacity_(storage_->capacity), pending_capacity_(0),
+                                head_(0), tail_(0), reserve_(0), summarized_(0) {
   clear();
   set_start_timestamp(cur_time);
 }
 
 AudioRing::AudioRing(const std::chrono::milliseconds &buffer_capacity)
-                                : ThreadSafeRing<std::int16_t>(time_to_count(buffer_capacity)),
-                                time_inc_(count_to_time_ns(1)), audio_start_set(false) {
+                                : origin_ns_(0), audio_start_set_(false),
+                                storage_(std::make_shared<Storage>(
+                                            time_to_count(buffer_capacity), 0)),
+                                capacity_(storage_->capacity), pending_capacity_(0),
+                                head_(0), tail_(0), reserve_(0), summarized_(0) {
   clear();
 }
 
-std::tuple<std::vector<float>, std::chrono::system_clock::time_point> AudioRing::peak() const {
-  std::lock_guard<std::mutex> lock(mutex_);
+void AudioRing::enqueue(const std::vector<std::int16_t> &data) {
+  enqueue(data.data(), data.size());
+}
+
+void AudioRing::enqueue(const std::int16_t *data, std::size_t count) {
+  if ( count == 0 ) {
+    return;
+  }
+  write_(data, count);
+}
+
+void AudioRing::write_(const std::int16_t *data, std::size_t count) {
+  const std::size_t pending_capacity = pending_capacity_.exchange(0, std::memory_order_acq_rel);
+  if ( pending_capacity > 0 && pending_capacity != storage_->capacity ) {
+    apply_resize_(pending_capacity);
+  }
+
+  Storage &storage = *storage_;
+  std::uint64_t head = head_.load(std::memory_order_relaxed);
+
+  // Samples that do not fit are dropped straight away, only the newest capacity are written
+  if ( count > storage.capacity ) {
+    if ( data ) {
+      data += count - storage.capacity;
+    }
+    head += count - storage.capacity;
+    count = storage.capacity;
+  }
+
+  // Announce which slots are about to be overwritten before touching them
+  reserve_.store(head + count, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  // At most two contiguous runs: up to the end of the storage, then from its start
+  const std::size_t pos = head % storage.size;
+  const std::size_t first = std::min(count, storage.size - pos);
+  if ( data ) {
+    std::memcpy(storage.samples.data() + pos, data, first * sizeof(std::int16_t));
+    std::memcpy(storage.samples.data(), data + first, (count - first) * sizeof(std::int16_t));
+  } else {
+    std::memset(storage.samples.data() + pos, 0, first * sizeof(std::int16_t));
+    std::memset(storage.samples.data(), 0, (count - first) * sizeof(std::int16_t));
+  }
+
+  // Drop the oldest data if the buffer overflows, then publish the new data (and its summary)
+  const std::uint64_t new_head = head + count;
+  summarize_(new_head);
+  if ( new_head - tail_.load(std::memory_order_relaxed) > storage.capacity ) {
+    tail_.store(new_head - storage.capacity, std::memory_order_release);
+  }
+  head_.store(new_head, std::memory_order_release);
+}
+
+void AudioRing::summarize_(std::uint64_t head) {
+  Storage &storage = *storage_;
+
+  // Blocks that were dropped without ever being in the buffer are not summarized
+  if ( head > storage.capacity ) {
+    summarized_ = std::max<std::uint64_t>(summarized_,
+                          (head - storage.capacity + block_size - 1) / block_size * block_size);
+  }
+
+  std::int16_t block[block_size];
+  for (; summarized_ + block_size <= head; summarized_ += block_size) {
+    const std::size_t pos = summarized_ % storage.size;
+    const std::size_t first = std::min(block_size, storage.size - pos);
+    std::memcpy(block, storage.samples.data() + pos, first * sizeof(std::int16_t));
+    std::memcpy(block + first, storage.samples.data(),
+                (block_size - first) * sizeof(std::int16_t));
+
+    AudioBlock summary = summarize_block(block, block_size);
+    if ( spectral_flux_ ) {
+      summary.spectral_flux = (*spectral_flux_)(block);
+    }
+    storage.blocks[(summarized_ / block_size) % storage.blocks.size()] = summary;
+  }
+}
+
+void AudioRing::resize(const std::chrono::milliseconds &buffer_capacity) {
+  pending_capacity_.store(std::max<std::size_t>(time_to_count(buffer_capacity), block_size),
+                          std::memory_order_release);
+}
+
+void AudioRing::apply_resize_(std::size_t capacity) {
+  const Storage &old_storage = *storage_;
+  const std::uint64_t head = head_.load(std::memory_order_relaxed);
+  const std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+  const std::uint64_t start = std::max(tail, head - std::min<std::uint64_t>(head, capacity));
+
+  // Copy the newest samples (and summaries) to the same absolute indices in the new storage
+  auto storage = std::make_shared<Storage>(capacity, start);
+  for (std::uint64_t i = start; i < head; ++i) {
+    storage->samples[i % storage->size] = old_storage.samples[i % old_storage.size];
+  }
+  for (std::uint64_t b = start / block_size; b < head / block_size; ++b) {
+    storage->blocks[b % storage->blocks.size()] = old_storage.blocks[b % old_storage.blocks.size()];
+  }
 
+  // Readers still holding the old storage can finish with it, it is not written anymore
+  std::atomic_store(&storage_, storage);
+  tail_.store(start, std::memory_order_release);
+  capacity_.store(capacity, std::memory_order_release);
+}
+
+std::shared_ptr<const AudioRing::Storage> AudioRing::window_(std::uint64_t &start,
+                                                             std::uint64_t &head) const {
+  head = head_.load(std::memory_order_acquire);
+  const std::uint64_t tail = std::min(tail_.load(std::memory_order_acquire), head);
+  std::shared_ptr<const Storage> storage = std::atomic_load(&storage_);
+  start = head - std::min<std::uint64_t>(head - tail, storage->capacity);
+  start = std::min(std::max(start, storage->first_valid), head);
+  return storage;
+}
+
+void AudioRing::set_spectral_flux(bool enabled) {
+  if ( enabled && !spectral_flux_ ) {
+    spectral_flux_ = std::make_unique<SpectralFlux>(block_size);
+  } else if ( !enabled ) {
+    spectral_flux_.reset();
+  }
+}
+
+std::uint64_t AudioRing::peak_blocks(std::vector<AudioBlock> &out) const {
+  std::uint64_t start, head;
+  const auto storage = window_(start, head);
+
+  const std::uint64_t first_block = (start + block_size - 1) / block_size;
+  const std::uint64_t end_block = head / block_size;
+  out.clear();
+  for (std::uint64_t b = first_block; b < end_block; ++b) {
+    out.push_back(storage->blocks[b % storage->blocks.size()]);
+  }
+  return first_block;
+}
+
+std::tuple<std::vector<float>, std::chrono::system_clock::time_point> AudioRing::peak() const {
   std::vector<float> result;
-  result.reserve(this->size());
-  for (std::size_t i = 0; i < this->size_; ++i) {
-    result.push_back(static_cast<float>(this->buffer_[(this->tail_ + i) % this->capacity_]) /
-                     static_cast<float>(std::numeric_limits<std::int16_t>::max()));
+  auto timestamp = peak_into(result);
+  return {result, timestamp};
+}
+
+std::chrono::system_clock::time_point AudioRing::peak_into(std::vector<float> &out,
+                                                    std::uint64_t *first_sample,
+                                                    const std::uint64_t &from_sample) const {
+  std::uint64_t start, head;
+  const auto storage = window_(start, head);
+  start = std::max(start, std::min(from_sample, head));
+
+  out.resize(head - start);
+  const std::size_t pos = start % storage->size;
+  const std::size_t first = std::min<std::size_t>(out.size(), storage->size - pos);
+  int16_to_float(storage->samples.data() + pos, out.data(), first);
+  int16_to_float(storage->samples.data(), out.data() + first, out.size() - first);
+
+  // Anything the producer reserved while we were copying may be torn, drop it from the front.
+  //    After a resize the old storage is no longer written, this only errs on the safe side.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t reserve = reserve_.load(std::memory_order_relaxed);
+  if ( reserve > start + storage->size ) {
+    const std::uint64_t torn = std::min<std::uint64_t>(reserve - storage->size - start,
+                                                       out.size());
+    out.erase(out.begin(), out.begin() + torn);
+    start += torn;
   }
-  return {result, audio_start_};
+
+  if ( first_sample ) {
+    *first_sample = start;
+  }
+  return sample_time(start);
+}
+
+void AudioRing::peak_range(std::uint64_t &first_sample, std::uint64_t &end_sample,
+                           const std::uint64_t &from_sample) const {
+  window_(first_sample, end_sample);
+  first_sample = std::max(first_sample, std::min(from_sample, end_sample));
+}
+
+std::size_t AudioRing::size() const {
+  std::uint64_t start, head;
+  window_(start, head);
+  return head - start;
 }
 
 void AudioRing::clear() {
   // First clear
-  ThreadSafeRing<std::int16_t>::clear();
+  tail_.store(head_.load(std::memory_order_relaxed), std::memory_order_release);
 
   // Then, enqueue 2 seconds of silence
-  enqueue(std::vector<std::int16_t>(WHISPER_SAMPLE_RATE*2, 0));
-  audio_start_set = false;
-}
-
-void AudioRing::increment_tail_() {
-  audio_start_ += time_inc_;
-  ThreadSafeRing::increment_tail_();
+  write_(nullptr, WHISPER_SAMPLE_RATE*2);
+  audio_start_set_.store(false, std::memory_order_release);
 }
 
 size_t AudioRing::decay(std::chrono::system_clock::time_point cur_time) {
-  auto audio_end = audio_start_ + count_to_time(size_);
+  auto audio_end = sample_time(head_.load(std::memory_order_relaxed));
   if (audio_end > cur_time) {
     // Somehow the audio buffer goes past the current time, nothing to do
     return 0;
   }
-  std::chrono::milliseconds diff_ms = 
-          std::chrono::duration_cast<std::chrono::milliseconds>(cur_time - audio_end);
-  size_t zeros_to_add = time_to_count(diff_ms);
-  enqueue(std::vector<std::int16_t>(zeros_to_add, 0));
+  size_t zeros_to_add = time_to_count_ns(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(cur_time - audio_end));
+  if ( zeros_to_add > 0 ) {
+    write_(nullptr, zeros_to_add);
+  }
   return zeros_to_add;
 }
 
 void AudioRing::set_start_timestamp(std::chrono::system_clock::time_point cur_time) {
-  std::lock_guard<std::mutex> lock(mutex_);
   // Since we are setting the start time of the buffer based on the current time,
   //    subtract what data is in the buffer against the current time.
-  std::chrono::milliseconds elapsed = count_to_time(size_);
-  if (elapsed > 
-          std::chrono::duration_cast<std::chrono::milliseconds>(cur_time.time_since_epoch())) {
+  const std::uint64_t head = head_.load(std::memory_order_relaxed);
+  std::chrono::nanoseconds elapsed = count_to_time_ns(head);
+  if (elapsed > cur_time.time_since_epoch()) {
     // Shouldn't be possible, cur time should be seconds from 1970
-    audio_start_ = cur_time;
+    origin_ns_.store(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        cur_time.time_since_epoch()).count(), std::memory_order_release);
     return;
   }
-  audio_start_ = cur_time - elapsed;
-  audio_start_set = true;
+  origin_ns_.store(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      (cur_time - elapsed).time_since_epoch()).count(), std::memory_order_release);
+  audio_start_set_.store(true, std::memory_order_release);
+}
+
+void AudioRing::adjust_timestamps(const std::chrono::nanoseconds &correction) {
+  origin_ns_.fetch_add(correction.count(), std::memory_order_acq_rel);
 }
 
 std::chrono::system_clock::time_point AudioRing::get_start_timestamp() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return audio_start_;
+  std::uint64_t start, head;
+  window_(start, head);
+  return sample_time(start);
+}
+
+std::chrono::system_clock::time_point AudioRing::sample_time(const std::uint64_t &index) const {
+  auto origin = std::chrono::system_clock::time_point(
+                  std::chrono::nanoseconds(origin_ns_.load(std::memory_order_acquire)));
+  return origin + count_to_time_ns(index);
 }
 
+std::shared_ptr<BroadcastRing<std::int16_t>> get_audio_bus(
+                  const std::string &name, const std::size_t &capacity,
+                  SlowReaderPolicy policy) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::weak_ptr<BroadcastRing<std::int16_t>>> registry;
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto bus = registry[name].lock();
+  if ( !bus ) {
+    bus = std::make_shared<BroadcastRing<std::int16_t>>(capacity, policy);
+    registry[name] = bus;
+  }
+  return bus;
+}
 
 } // end of namespace whisper
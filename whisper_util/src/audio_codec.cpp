@@ -0,0 +1,384 @@
+#include "whisper_util/audio_codec.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace whisper {
+
+namespace {
+// Lanes are flushed into 64 bit sums before |residual| <= 2^20 can overflow them
+constexpr std::size_t kFlushInterval = 1024;
+
+// Order code of a channel that is stored without prediction
+constexpr std::size_t verbatim = 7;
+
+class BitWriter {
+public:
+  BitWriter(std::vector<std::uint8_t> &out) : out_(out), acc_(0), bits_(0) {}
+
+  // Append the lowest n <= 32 bits of value
+  inline void put(std::uint32_t value, int n) {
+    acc_ = (acc_ << n) | (value & ((std::uint64_t{1} << n) - 1));
+    bits_ += n;
+    while ( bits_ >= 8 ) {
+      bits_ -= 8;
+      out_.push_back(static_cast<std::uint8_t>(acc_ >> bits_));
+    }
+  }
+
+  inline void put_rice(std::uint32_t u, int k) {
+    std::uint32_t q = u >> k;
+    for (; q >= 32; q -= 32) {
+      put(0, 32);
+    }
+    put(1, q + 1);
+    if ( k > 0 ) {
+      put(u, k);
+    }
+  }
+
+  inline void flush() {
+    if ( bits_ > 0 ) {
+      out_.push_back(static_cast<std::uint8_t>(acc_ << (8 - bits_)));
+    }
+    acc_ = 0;
+    bits_ = 0;
+  }
+
+private:
+  std::vector<std::uint8_t> &out_;
+  std::uint64_t acc_;
+  int bits_;
+};
+
+class BitReader {
+public:
+  BitReader(const std::uint8_t *data, std::size_t size)
+      : data_(data), end_(data + size), total_bits_(size * 8), consumed_(0), acc_(0),
+        bits_(0) {}
+
+  // Read n <= 32 bits
+  inline std::uint32_t get(int n) {
+    refill_();
+    const std::uint32_t value = n == 0 ? 0 : static_cast<std::uint32_t>(acc_ >> (64 - n));
+    acc_ <<= n;
+    bits_ -= n;
+    consumed_ += n;
+    return value;
+  }
+
+  inline bool get_rice(int k, std::uint32_t &u) {
+    std::uint64_t q = 0;
+    for (;;) {
+      refill_();
+      if ( acc_ == 0 ) {
+        // All zeros so far, past the end of the data this never terminates on its own
+        q += bits_;
+        consumed_ += bits_;
+        bits_ = 0;
+        if ( !ok() || q > std::numeric_limits<std::uint32_t>::max() ) {
+          return false;
+        }
+        continue;
+      }
+      const int zeros = __builtin_clzll(acc_);
+      q += zeros;
+      acc_ <<= zeros + 1;
+      bits_ -= zeros + 1;
+      consumed_ += zeros + 1;
+      break;
+    }
+    if ( q > (std::numeric_limits<std::uint32_t>::max() >> k) ) {
+      return false;
+    }
+    u = static_cast<std::uint32_t>(q << k) | get(k);
+    return true;
+  }
+
+  // Skip to the next byte boundary
+  inline void align() { get((8 - consumed_ % 8) % 8); }
+
+  // Nothing was read past the end of the data
+  inline bool ok() const { return consumed_ <= total_bits_; }
+
+private:
+  inline void refill_() {
+    // Left aligned, zeros past the end of the data
+    while ( bits_ <= 56 ) {
+      const std::uint64_t byte = data_ < end_ ? *data_++ : 0;
+      acc_ |= byte << (56 - bits_);
+      bits_ += 8;
+    }
+  }
+
+  const std::uint8_t *data_;
+  const std::uint8_t *end_;
+  const std::uint64_t total_bits_;
+  std::uint64_t consumed_;
+  std::uint64_t acc_;
+  int bits_;
+};
+
+inline std::uint32_t zigzag(std::int32_t value) {
+  return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+inline std::int32_t unzigzag(std::uint32_t value) {
+  return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+}
+
+inline std::int32_t residual(const std::int32_t *x, std::size_t i, std::size_t order) {
+  switch ( order ) {
+    case 0: return x[i];
+    case 1: return x[i] - x[i - 1];
+    case 2: return x[i] - 2 * x[i - 1] + x[i - 2];
+    case 3: return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+    default: return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+  }
+}
+
+inline std::int32_t prediction(const std::int32_t *x, std::size_t i, std::size_t order) {
+  switch ( order ) {
+    case 0: return 0;
+    case 1: return x[i - 1];
+    case 2: return 2 * x[i - 1] - x[i - 2];
+    case 3: return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+    default: return 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+  }
+}
+
+// Rice parameter close to log2 of the mean
+inline int rice_parameter(std::uint64_t sum, std::size_t count) {
+  int k = 0;
+  while ( k < 30 && (static_cast<std::uint64_t>(count) << (k + 1)) < sum ) {
+    ++k;
+  }
+  return k;
+}
+} // end of anonymous namespace
+
+std::array<std::uint64_t, AudioEncoder::max_order + 1>
+fixed_residual_sums(const std::int32_t *x, std::size_t n) {
+  std::array<std::uint64_t, AudioEncoder::max_order + 1> sums{};
+  std::size_t i = AudioEncoder::max_order;
+  // Differences of differences, so only subtractions are needed:
+  //    d_k(i) = d_(k-1)(i) - d_(k-1)(i - 1)
+#if defined(__AVX2__)
+  while ( i + 8 <= n ) {
+    __m256i acc[AudioEncoder::max_order + 1];
+    for (auto &a : acc) {
+      a = _mm256_setzero_si256();
+    }
+    for (std::size_t j = 0; j < kFlushInterval && i + 8 <= n; ++j, i += 8) {
+      __m256i x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+      __m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i - 1));
+      __m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i - 2));
+      __m256i x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i - 3));
+      __m256i x4 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i - 4));
+      __m256i d10 = _mm256_sub_epi32(x0, x1), d11 = _mm256_sub_epi32(x1, x2);
+      __m256i d12 = _mm256_sub_epi32(x2, x3), d13 = _mm256_sub_epi32(x3, x4);
+      __m256i d20 = _mm256_sub_epi32(d10, d11), d21 = _mm256_sub_epi32(d11, d12);
+      __m256i d22 = _mm256_sub_epi32(d12, d13);
+      __m256i d30 = _mm256_sub_epi32(d20, d21), d31 = _mm256_sub_epi32(d21, d22);
+      __m256i d40 = _mm256_sub_epi32(d30, d31);
+      acc[0] = _mm256_add_epi32(acc[0], _mm256_abs_epi32(x0));
+      acc[1] = _mm256_add_epi32(acc[1], _mm256_abs_epi32(d10));
+      acc[2] = _mm256_add_epi32(acc[2], _mm256_abs_epi32(d20));
+      acc[3] = _mm256_add_epi32(acc[3], _mm256_abs_epi32(d30));
+      acc[4] = _mm256_add_epi32(acc[4], _mm256_abs_epi32(d40));
+    }
+    for (std::size_t k = 0; k <= AudioEncoder::max_order; ++k) {
+      alignas(32) std::uint32_t lanes[8];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc[k]);
+      for (auto lane : lanes) {
+        sums[k] += lane;
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  while ( i + 4 <= n ) {
+    __m128i acc[AudioEncoder::max_order + 1];
+    for (auto &a : acc) {
+      a = _mm_setzero_si128();
+    }
+    // SSE2 has no abs_epi32:  |v| = (v ^ s) - s with s = v >> 31
+    auto abs_epi32 = [](__m128i v) {
+      const __m128i sign = _mm_srai_epi32(v, 31);
+      return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+    };
+    for (std::size_t j = 0; j < kFlushInterval && i + 4 <= n; ++j, i += 4) {
+      __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+      __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i - 1));
+      __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i - 2));
+      __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i - 3));
+      __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i - 4));
+      __m128i d10 = _mm_sub_epi32(x0, x1), d11 = _mm_sub_epi32(x1, x2);
+      __m128i d12 = _mm_sub_epi32(x2, x3), d13 = _mm_sub_epi32(x3, x4);
+      __m128i d20 = _mm_sub_epi32(d10, d11), d21 = _mm_sub_epi32(d11, d12);
+      __m128i d22 = _mm_sub_epi32(d12, d13);
+      __m128i d30 = _mm_sub_epi32(d20, d21), d31 = _mm_sub_epi32(d21, d22);
+      __m128i d40 = _mm_sub_epi32(d30, d31);
+      acc[0] = _mm_add_epi32(acc[0], abs_epi32(x0));
+      acc[1] = _mm_add_epi32(acc[1], abs_epi32(d10));
+      acc[2] = _mm_add_epi32(acc[2], abs_epi32(d20));
+      acc[3] = _mm_add_epi32(acc[3], abs_epi32(d30));
+      acc[4] = _mm_add_epi32(acc[4], abs_epi32(d40));
+    }
+    for (std::size_t k = 0; k <= AudioEncoder::max_order; ++k) {
+      alignas(16) std::uint32_t lanes[4];
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc[k]);
+      for (auto lane : lanes) {
+        sums[k] += lane;
+      }
+    }
+  }
+#elif defined(__ARM_NEON)
+  while ( i + 4 <= n ) {
+    uint32x4_t acc[AudioEncoder::max_order + 1];
+    for (auto &a : acc) {
+      a = vdupq_n_u32(0);
+    }
+    for (std::size_t j = 0; j < kFlushInterval && i + 4 <= n; ++j, i += 4) {
+      int32x4_t x0 = vld1q_s32(x + i), x1 = vld1q_s32(x + i - 1), x2 = vld1q_s32(x + i - 2);
+      int32x4_t x3 = vld1q_s32(x + i - 3), x4 = vld1q_s32(x + i - 4);
+      int32x4_t d10 = vsubq_s32(x0, x1), d11 = vsubq_s32(x1, x2);
+      int32x4_t d12 = vsubq_s32(x2, x3), d13 = vsubq_s32(x3, x4);
+      int32x4_t d20 = vsubq_s32(d10, d11), d21 = vsubq_s32(d11, d12);
+      int32x4_t d22 = vsubq_s32(d12, d13);
+      int32x4_t d30 = vsubq_s32(d20, d21), d31 = vsubq_s32(d21, d22);
+      int32x4_t d40 = vsubq_s32(d30, d31);
+      acc[0] = vaddq_u32(acc[0], vreinterpretq_u32_s32(vabsq_s32(x0)));
+      acc[1] = vaddq_u32(acc[1], vreinterpretq_u32_s32(vabsq_s32(d10)));
+      acc[2] = vaddq_u32(acc[2], vreinterpretq_u32_s32(vabsq_s32(d20)));
+      acc[3] = vaddq_u32(acc[3], vreinterpretq_u32_s32(vabsq_s32(d30)));
+      acc[4] = vaddq_u32(acc[4], vreinterpretq_u32_s32(vabsq_s32(d40)));
+    }
+    for (std::size_t k = 0; k <= AudioEncoder::max_order; ++k) {
+      sums[k] += vgetq_lane_u32(acc[k], 0) + static_cast<std::uint64_t>(vgetq_lane_u32(acc[k], 1)) +
+                 vgetq_lane_u32(acc[k], 2) + static_cast<std::uint64_t>(vgetq_lane_u32(acc[k], 3));
+    }
+  }
+#endif
+  // Scalar tail (or everything, without SIMD support)
+  for (; i < n; ++i) {
+    for (std::size_t k = 0; k <= AudioEncoder::max_order; ++k) {
+      const std::int32_t r = residual(x, i, k);
+      sums[k] += static_cast<std::uint32_t>(r < 0 ? -r : r);
+    }
+  }
+  return sums;
+}
+
+std::size_t AudioEncoder::encode(const std::int16_t *in, std::size_t frames,
+                                 std::size_t channels, std::vector<std::uint8_t> &out) {
+  const std::size_t start = out.size();
+  BitWriter writer(out);
+  channel_.resize(frames);
+
+  for (std::size_t c = 0; c < channels; ++c) {
+    const std::size_t channel_start = out.size();
+    for (std::size_t i = 0; i < frames; ++i) {
+      channel_[i] = in[i * channels + c];
+    }
+    const std::int32_t *x = channel_.data();
+
+    // The order with the smallest residual, short chunks are stored as they are
+    std::size_t order = 0;
+    if ( frames > 2 * max_order ) {
+      const auto sums = fixed_residual_sums(x, frames);
+      order = std::min_element(sums.begin(), sums.end()) - sums.begin();
+    }
+    writer.put(order, 3);
+    for (std::size_t i = 0; i < std::min(order, frames); ++i) {
+      writer.put(static_cast<std::uint16_t>(x[i]), 16);
+    }
+
+    std::uint32_t u[partition_size];
+    for (std::size_t begin = order; begin < frames; begin += partition_size) {
+      const std::size_t count = std::min(partition_size, frames - begin);
+      std::uint64_t sum = 0;
+      for (std::size_t j = 0; j < count; ++j) {
+        u[j] = zigzag(residual(x, begin + j, order));
+        sum += u[j];
+      }
+      const int k = rice_parameter(sum, count);
+      writer.put(k, 5);
+      for (std::size_t j = 0; j < count; ++j) {
+        writer.put_rice(u[j], k);
+      }
+    }
+    writer.flush();
+
+    // Noise does not compress, store it as it is instead
+    if ( out.size() - channel_start > frames * sizeof(std::int16_t) + 1 ) {
+      out.resize(channel_start);
+      writer.put(verbatim, 3);
+      for (std::size_t i = 0; i < frames; ++i) {
+        writer.put(static_cast<std::uint16_t>(x[i]), 16);
+      }
+      writer.flush();
+    }
+  }
+  return out.size() - start;
+}
+
+bool decode_audio(const std::uint8_t *data, std::size_t size, std::size_t frames,
+                  std::size_t channels, std::int16_t *out) {
+  BitReader reader(data, size);
+  // The last max_order samples of the channel, x[i] lives at history[i % 8]
+  std::int32_t history[8];
+
+  for (std::size_t c = 0; c < channels; ++c) {
+    const std::size_t order = reader.get(3);
+    if ( order == verbatim ) {
+      for (std::size_t i = 0; i < frames; ++i) {
+        out[i * channels + c] = static_cast<std::int16_t>(reader.get(16));
+      }
+      reader.align();
+      continue;
+    }
+    if ( order > AudioEncoder::max_order ) {
+      return false;
+    }
+    for (std::size_t i = 0; i < std::min(order, frames); ++i) {
+      history[i % 8] = static_cast<std::int16_t>(reader.get(16));
+      out[i * channels + c] = history[i % 8];
+    }
+
+    for (std::size_t begin = order; begin < frames; begin += AudioEncoder::partition_size) {
+      const std::size_t count = std::min(AudioEncoder::partition_size, frames - begin);
+      const int k = reader.get(5);
+      for (std::size_t i = begin; i < begin + count; ++i) {
+        std::uint32_t u;
+        if ( !reader.get_rice(k, u) ) {
+          return false;
+        }
+        // Predict from the ring of the last samples
+        std::int32_t x[AudioEncoder::max_order + 1];
+        for (std::size_t j = 1; j <= order; ++j) {
+          x[AudioEncoder::max_order - j] = history[(i - j) % 8];
+        }
+        const std::int64_t value = static_cast<std::int64_t>(unzigzag(u)) +
+                                   prediction(x, AudioEncoder::max_order, order);
+        if ( value < std::numeric_limits<std::int16_t>::min() ||
+             value > std::numeric_limits<std::int16_t>::max() ) {
+          return false;
+        }
+        history[i % 8] = value;
+        out[i * channels + c] = static_cast<std::int16_t>(value);
+      }
+    }
+    reader.align();
+  }
+  return reader.ok();
+}
+
+} // end of namespace whisper
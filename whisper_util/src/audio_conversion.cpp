@@ -0,0 +1,56 @@
+#include "whisper_util/audio_conversion.hpp"
+
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace whisper {
+
+namespace {
+constexpr float kInt16Scale = 1.f / static_cast<float>(std::numeric_limits<std::int16_t>::max());
+}
+
+void int16_to_float(const std::int16_t *src, float *dst, std::size_t n) {
+  std::size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 scale = _mm256_set1_ps(kInt16Scale);
+  for (; i + 16 <= n; i += 16) {
+    __m256i s16 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s16));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s16, 1));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+    _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+  }
+#elif defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(kInt16Scale);
+  for (; i + 8 <= n; i += 8) {
+    __m128i s16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    // Sign extend by unpacking into the upper half and shifting back down
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s16, s16), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#elif defined(__ARM_NEON)
+  const float32x4_t scale = vdupq_n_f32(kInt16Scale);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t s16 = vld1q_s16(src + i);
+    int32x4_t lo = vmovl_s16(vget_low_s16(s16));
+    int32x4_t hi = vmovl_s16(vget_high_s16(s16));
+    vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(lo), scale));
+    vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(hi), scale));
+  }
+#endif
+  // Scalar tail (or everything, without SIMD support)
+  for (; i < n; ++i) {
+    dst[i] = static_cast<float>(src[i]) * kInt16Scale;
+  }
+}
+
+} // end of namespace whisper
@@ -0,0 +1,209 @@
+#include "whisper_util/audio_sources.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace whisper {
+
+namespace {
+std::uint32_t read_le32(const char *bytes) {
+  return static_cast<std::uint8_t>(bytes[0]) | static_cast<std::uint8_t>(bytes[1]) << 8 |
+         static_cast<std::uint8_t>(bytes[2]) << 16 |
+         static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes[3])) << 24;
+}
+
+std::uint16_t read_le16(const char *bytes) {
+  return static_cast<std::uint8_t>(bytes[0]) | static_cast<std::uint8_t>(bytes[1]) << 8;
+}
+} // end of anonymous namespace
+
+FileSource::FileSource(const std::string &path, std::uint32_t sample_rate,
+                       std::uint16_t channels, bool loop)
+    : AudioSourceBackend(sample_rate, channels), file_(path, std::ios::binary),
+      data_frames_(std::numeric_limits<std::uint64_t>::max()), position_(0), loop_(loop),
+      done_(false) {
+  if ( !file_ ) {
+    throw std::runtime_error("Failed to open " + path + ".");
+  }
+
+  char magic[4] = {};
+  file_.read(magic, sizeof(magic));
+  file_.seekg(0);
+  if ( file_ && std::memcmp(magic, "RIFF", 4) == 0 ) {
+    read_wav_header_(path);
+  } else {
+    if ( channels_ == 0 || sample_rate_ == 0 ) {
+      throw std::runtime_error("Invalid audio format in " + path + ".");
+    }
+    file_.clear();
+    file_.seekg(0, std::ios::end);
+    data_frames_ = static_cast<std::uint64_t>(file_.tellg()) / (channels_ * sizeof(std::int16_t));
+    file_.seekg(0);
+  }
+  data_start_ = file_.tellg();
+}
+
+void FileSource::read_wav_header_(const std::string &path) {
+  char riff[12];
+  file_.read(riff, sizeof(riff));
+  if ( !file_ || std::memcmp(riff + 8, "WAVE", 4) != 0 ) {
+    throw std::runtime_error(path + " is not a WAV file.");
+  }
+
+  // Walk the chunks until the samples, fmt has to come first
+  bool has_format = false;
+  char header[8];
+  while ( file_.read(header, sizeof(header)) ) {
+    const std::uint32_t size = read_le32(header + 4);
+    if ( std::memcmp(header, "fmt ", 4) == 0 ) {
+      // Only the common 16 bytes are needed, extensions are skipped
+      char format[16];
+      if ( size < sizeof(format) || !file_.read(format, sizeof(format)) ) {
+        throw std::runtime_error(path + " has a broken fmt chunk.");
+      }
+      file_.seekg(size - sizeof(format), std::ios::cur);
+      const std::uint16_t tag = read_le16(format);
+      const std::uint16_t bits = read_le16(format + 14);
+      // PCM, or WAVE_FORMAT_EXTENSIBLE (which is PCM too for 16 bits)
+      if ( (tag != 1 && tag != 0xFFFE) || bits != 16 ) {
+        throw std::runtime_error(path + " is not 16 bit PCM.");
+      }
+      channels_ = read_le16(format + 2);
+      sample_rate_ = read_le32(format + 4);
+      if ( channels_ == 0 || sample_rate_ == 0 ) {
+        throw std::runtime_error("Invalid audio format in " + path + ".");
+      }
+      has_format = true;
+    } else if ( std::memcmp(header, "data", 4) == 0 ) {
+      if ( !has_format ) {
+        break;
+      }
+      data_frames_ = size / (channels_ * sizeof(std::int16_t));
+      return;
+    } else {
+      file_.seekg(size, std::ios::cur);
+    }
+    // Chunks are padded to an even size
+    if ( size % 2 == 1 ) {
+      file_.seekg(1, std::ios::cur);
+    }
+  }
+  throw std::runtime_error(path + " has no audio data.");
+}
+
+std::size_t FileSource::read(std::int16_t *out, std::size_t frames) {
+  std::size_t total = 0;
+  while ( total < frames && !done_ ) {
+    const std::size_t wanted = std::min<std::uint64_t>(frames - total, data_frames_ - position_);
+    file_.read(reinterpret_cast<char *>(out + total * channels_),
+               wanted * channels_ * sizeof(std::int16_t));
+    const std::size_t got = file_.gcount() / (channels_ * sizeof(std::int16_t));
+    total += got;
+    position_ += got;
+
+    if ( got == wanted && position_ < data_frames_ ) {
+      continue;
+    }
+    // End of the file (or of the data chunk)
+    if ( loop_ && position_ > 0 ) {
+      file_.clear();
+      file_.seekg(data_start_);
+      position_ = 0;
+    } else {
+      done_ = true;
+    }
+  }
+  return total;
+}
+
+PipeSource::PipeSource(const std::string &path, std::uint32_t sample_rate,
+                       std::uint16_t channels, int timeout_ms)
+    : AudioSourceBackend(sample_rate, channels), fd_(STDIN_FILENO), owns_fd_(false),
+      timeout_ms_(timeout_ms), done_(false) {
+  if ( channels_ == 0 || sample_rate_ == 0 ) {
+    throw std::runtime_error("Invalid audio format for " + path + ".");
+  }
+  if ( path != "-" ) {
+    // Non-blocking open, so a named pipe without writer does not block the constructor
+    fd_ = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    if ( fd_ < 0 ) {
+      throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+    owns_fd_ = true;
+  }
+}
+
+PipeSource::~PipeSource() {
+  if ( owns_fd_ ) {
+    ::close(fd_);
+  }
+}
+
+std::size_t PipeSource::read(std::int16_t *out, std::size_t frames) {
+  const std::size_t frame_bytes = channels_ * sizeof(std::int16_t);
+  char *bytes = reinterpret_cast<char *>(out);
+  std::size_t filled = partial_.size();
+  std::memcpy(bytes, partial_.data(), filled);
+  partial_.clear();
+
+  while ( filled < frames * frame_bytes ) {
+    pollfd pfd{fd_, POLLIN, 0};
+    const int ready = ::poll(&pfd, 1, timeout_ms_);
+    if ( ready < 0 && errno == EINTR ) {
+      continue;
+    }
+    if ( ready <= 0 ) {
+      break;
+    }
+    const ssize_t got = ::read(fd_, bytes + filled, frames * frame_bytes - filled);
+    if ( got < 0 && (errno == EAGAIN || errno == EINTR) ) {
+      continue;
+    }
+    if ( got <= 0 ) {
+      done_ = true;
+      break;
+    }
+    filled += got;
+  }
+
+  // Keep the bytes of an incomplete frame for the next read
+  const std::size_t whole = filled / frame_bytes;
+  partial_.assign(bytes + whole * frame_bytes, bytes + filled);
+  return whole;
+}
+
+SyntheticSource::SyntheticSource(Waveform waveform, std::uint32_t sample_rate,
+                                 std::uint16_t channels, double frequency, double amplitude)
+    : AudioSourceBackend(sample_rate, channels), waveform_(waveform),
+      phase_step_(2. * M_PI * frequency / sample_rate), phase_(0.),
+      amplitude_(std::clamp(amplitude, 0., 1.) * std::numeric_limits<std::int16_t>::max()),
+      noise_(-1., 1.) {
+  if ( channels_ == 0 || sample_rate_ == 0 ) {
+    throw std::runtime_error("Invalid synthetic audio format.");
+  }
+}
+
+std::size_t SyntheticSource::read(std::int16_t *out, std::size_t frames) {
+  for (std::size_t i = 0; i < frames; ++i) {
+    double value;
+    if ( waveform_ == Waveform::Tone ) {
+      value = std::sin(phase_);
+      phase_ = std::fmod(phase_ + phase_step_, 2. * M_PI);
+    } else {
+      value = noise_(random_);
+    }
+    std::fill_n(out + i * channels_, channels_,
+                static_cast<std::int16_t>(std::lround(amplitude_ * value)));
+  }
+  return frames;
+}
+
+} // end of namespace whisper
@@ -0,0 +1,62 @@
+#include "whisper_util/drift_estimator.hpp"
+
+#include "whisper.h"
+
+namespace whisper {
+
+DriftEstimator::DriftEstimator(const std::size_t &window_size) : window_size_(window_size) {
+}
+
+void DriftEstimator::add(const std::uint64_t &sample_index,
+                         std::chrono::system_clock::time_point stamp) {
+  observations_.emplace_back(sample_index,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                      stamp.time_since_epoch()).count());
+  while ( observations_.size() > window_size_ ) {
+    observations_.pop_front();
+  }
+}
+
+bool DriftEstimator::estimate(const std::uint64_t &sample_index,
+                              std::chrono::system_clock::time_point &expected,
+                              double &skew) const {
+  if ( observations_.size() < 2 ) {
+    return false;
+  }
+
+  // Regress in seconds relative to the oldest observation to keep the doubles precise.
+  //    x: nominal time from the sample count, y: observed time
+  const auto [x0, y0] = observations_.front();
+  const double n = static_cast<double>(observations_.size());
+  double sum_x = 0., sum_y = 0.;
+  for (const auto &[index, ns] : observations_) {
+    sum_x += static_cast<double>(index - x0) / WHISPER_SAMPLE_RATE;
+    sum_y += static_cast<double>(ns - y0) * 1e-9;
+  }
+  const double mean_x = sum_x / n, mean_y = sum_y / n;
+  double cov = 0., var = 0.;
+  for (const auto &[index, ns] : observations_) {
+    const double dx = static_cast<double>(index - x0) / WHISPER_SAMPLE_RATE - mean_x;
+    const double dy = static_cast<double>(ns - y0) * 1e-9 - mean_y;
+    cov += dx * dy;
+    var += dx * dx;
+  }
+  if ( var <= 0. ) {
+    return false;
+  }
+
+  const double slope = cov / var;
+  const double x = (static_cast<double>(sample_index) - static_cast<double>(x0)) /
+                   WHISPER_SAMPLE_RATE;
+  const double y = mean_y + slope * (x - mean_x);
+  expected = std::chrono::system_clock::time_point(
+                  std::chrono::nanoseconds(y0 + static_cast<std::int64_t>(y * 1e9)));
+  skew = slope - 1.;
+  return true;
+}
+
+void DriftEstimator::clear() {
+  observations_.clear();
+}
+
+} // end of namespace whisper
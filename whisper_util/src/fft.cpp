@@ -0,0 +1,54 @@
+#include "whisper_util/fft.hpp"
+
+#include <cmath>
+
+namespace whisper {
+
+FftPlan::FftPlan(const std::size_t &size)
+    : size_(size), twiddles_(size), input_(size), output_(size) {
+  for (std::size_t k = 0; k < size_; ++k) {
+    const double angle = -2. * M_PI * static_cast<double>(k) / static_cast<double>(size_);
+    twiddles_[k] = {static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle))};
+  }
+}
+
+void FftPlan::power_spectrum(const float *input, float *output) {
+  for (std::size_t i = 0; i < size_; ++i) {
+    input_[i] = {input[i], 0.f};
+  }
+  transform_(input_.data(), 1, output_.data(), size_);
+  for (std::size_t k = 0; k < bins(); ++k) {
+    output[k] = std::norm(output_[k]);
+  }
+}
+
+void FftPlan::transform_(const std::complex<float> *input, std::size_t stride,
+                         std::complex<float> *output, std::size_t size) {
+  // Twiddles of this sub-transform are every step'th twiddle of the full one
+  const std::size_t step = size_ / size;
+
+  if ( size % 2 == 1 ) {
+    // Direct DFT of the odd remainder
+    for (std::size_t k = 0; k < size; ++k) {
+      std::complex<float> sum = 0.f;
+      for (std::size_t j = 0; j < size; ++j) {
+        sum += input[j * stride] * twiddles_[((j * k) % size) * step];
+      }
+      output[k] = sum;
+    }
+    return;
+  }
+
+  // Even samples into the first half, odd samples into the second half, then combine
+  const std::size_t half = size / 2;
+  transform_(input, 2 * stride, output, half);
+  transform_(input + stride, 2 * stride, output + half, half);
+  for (std::size_t k = 0; k < half; ++k) {
+    const std::complex<float> even = output[k];
+    const std::complex<float> odd = output[k + half] * twiddles_[k * step];
+    output[k] = even + odd;
+    output[k + half] = even - odd;
+  }
+}
+
+} // end of namespace whisper
@@ -0,0 +1,99 @@
+#include "whisper_util/jitter_buffer.hpp"
+
+namespace whisper {
+
+JitterBuffer::JitterBuffer(const std::chrono::milliseconds &latency,
+                           const std::size_t &max_chunks,
+                           const std::chrono::milliseconds &restart_gap)
+    : latency_(latency), max_chunks_(max_chunks), restart_gap_(restart_gap) {
+  clear();
+}
+
+bool JitterBuffer::is_restart_(const std::uint64_t &sequence,
+                               std::chrono::system_clock::time_point stamp) const {
+  if ( !started_ ) {
+    return false;
+  }
+  if ( sequence < next_sequence_ ) {
+    // A late chunk was captured before the last one played out, and not further back than any
+    //    chunk we could still be waiting for
+    return next_sequence_ - sequence > max_chunks_ || stamp > last_stamp_;
+  }
+  if ( stamp < last_stamp_ ) {
+    return true;
+  }
+  // Across a hole the stamp may legitimately move ahead by any number of lost chunks
+  return sequence == next_sequence_ && stamp - last_stamp_ > restart_gap_;
+}
+
+bool JitterBuffer::push(Chunk &&chunk, std::chrono::system_clock::time_point arrival) {
+  if ( is_restart_(chunk.sequence, chunk.stamp) ) {
+    // Whatever is pending belongs to the old stream
+    lost_chunks_ += pending_.size();
+    pending_.clear();
+    started_ = false;
+    restarted_ = true;
+  } else if ( started_ && chunk.sequence < next_sequence_ ) {
+    // Its slot was already played out (or declared lost)
+    ++late_chunks_;
+    return false;
+  }
+  const auto sequence = chunk.sequence;
+  return pending_.emplace(sequence, Pending{std::move(chunk), arrival}).second;
+}
+
+bool JitterBuffer::pass(const std::uint64_t &sequence,
+                        std::chrono::system_clock::time_point stamp) {
+  if ( !pending_.empty() ||
+       (started_ && (sequence != next_sequence_ || is_restart_(sequence, stamp))) ) {
+    return false;
+  }
+  started_ = true;
+  next_sequence_ = sequence + 1;
+  last_stamp_ = stamp;
+  return true;
+}
+
+long JitterBuffer::pop(Chunk &out, std::chrono::system_clock::time_point now, bool *restarted) {
+  if ( pending_.empty() ) {
+    return -1;
+  }
+  auto first = pending_.begin();
+  if ( !started_ ) {
+    // The very first chunk defines the start of the stream
+    started_ = true;
+    next_sequence_ = first->first;
+  }
+
+  long lost = 0;
+  if ( first->first != next_sequence_ ) {
+    // There is a hole, wait for it to be filled unless we have waited long enough
+    if ( now - first->second.arrival < latency_ && pending_.size() < max_chunks_ ) {
+      return -1;
+    }
+    lost = static_cast<long>(first->first - next_sequence_);
+    lost_chunks_ += lost;
+  }
+
+  out = std::move(first->second.chunk);
+  next_sequence_ = first->first + 1;
+  last_stamp_ = out.stamp;
+  pending_.erase(first);
+  if ( restarted ) {
+    *restarted = restarted_;
+  }
+  restarted_ = false;
+  return lost;
+}
+
+void JitterBuffer::clear() {
+  pending_.clear();
+  started_ = false;
+  restarted_ = false;
+  next_sequence_ = 0;
+  last_stamp_ = std::chrono::system_clock::time_point();
+  late_chunks_ = 0;
+  lost_chunks_ = 0;
+}
+
+} // end of namespace whisper
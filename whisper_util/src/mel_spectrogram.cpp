@@ -0,0 +1,197 @@
+#include "whisper_util/mel_spectrogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "whisper_util/audio_conversion.hpp"
+
+namespace whisper {
+
+namespace {
+// Slaney's mel scale: linear below 1 kHz, logarithmic above
+constexpr double f_sp = 200. / 3.;
+constexpr double min_log_hz = 1000.;
+constexpr double min_log_mel = min_log_hz / f_sp;
+const double logstep = std::log(6.4) / 27.;
+
+double hz_to_mel(double hz) {
+  return hz < min_log_hz ? hz / f_sp : min_log_mel + std::log(hz / min_log_hz) / logstep;
+}
+
+double mel_to_hz(double mel) {
+  return mel < min_log_mel ? f_sp * mel : min_log_hz * std::exp(logstep * (mel - min_log_mel));
+}
+
+// Whisper's floor for the power of a mel band, log10 of it is the value of silence
+constexpr float min_log_power = -10.f;
+} // end of anonymous namespace
+
+std::vector<float> mel_filters(std::size_t n_mels, std::size_t n_fft, std::size_t sample_rate) {
+  const std::size_t bins = n_fft / 2 + 1;
+
+  // n_mels + 2 band edges, evenly spaced in mel from 0 to Nyquist
+  std::vector<double> edges(n_mels + 2);
+  const double max_mel = hz_to_mel(sample_rate / 2.);
+  for (std::size_t i = 0; i < edges.size(); ++i) {
+    edges[i] = mel_to_hz(max_mel * i / (n_mels + 1));
+  }
+
+  // Triangles from edge i over i + 1 to i + 2, scaled to the same area
+  std::vector<float> filters(n_mels * bins, 0.f);
+  for (std::size_t m = 0; m < n_mels; ++m) {
+    const double norm = 2. / (edges[m + 2] - edges[m]);
+    for (std::size_t k = 0; k < bins; ++k) {
+      const double hz = static_cast<double>(k) * sample_rate / n_fft;
+      const double lower = (hz - edges[m]) / (edges[m + 1] - edges[m]);
+      const double upper = (edges[m + 2] - hz) / (edges[m + 2] - edges[m + 1]);
+      filters[m * bins + k] = std::max(0., std::min(lower, upper)) * norm;
+    }
+  }
+  return filters;
+}
+
+MelRing::MelRing(const std::size_t &capacity, const std::size_t &n_mels)
+    : n_mels_(n_mels), band_start_(n_mels), band_weights_(n_mels), fft_(n_fft),
+      window_(n_fft), frame_(n_fft), power_(fft_.bins()), samples_start_(0),
+      samples_written_(0), capacity_frames_(std::max<std::size_t>(capacity / hop_length, 1)),
+      frames_(capacity_frames_ * n_mels), first_frame_(0), next_frame_(0), started_(false) {
+  // Periodic Hann window, as whisper.cpp
+  for (std::size_t i = 0; i < n_fft; ++i) {
+    window_[i] = 0.5f * (1.f - std::cos(2. * M_PI * i / n_fft));
+  }
+
+  // Each band only covers a handful of bins, keep just those
+  const auto filters = mel_filters(n_mels);
+  const std::size_t bins = fft_.bins();
+  for (std::size_t m = 0; m < n_mels; ++m) {
+    const auto row = filters.begin() + m * bins;
+    auto first = std::find_if(row, row + bins, [](float w) { return w > 0.f; });
+    auto last = std::find_if(std::make_reverse_iterator(row + bins),
+                             std::make_reverse_iterator(first),
+                             [](float w) { return w > 0.f; }).base();
+    band_start_[m] = first - row;
+    band_weights_[m].assign(first, last);
+  }
+}
+
+void MelRing::reset_(std::uint64_t first_sample) {
+  samples_.clear();
+  samples_start_ = first_sample;
+  samples_written_ = first_sample;
+  // The first frame whose window starts at or after first_sample
+  first_frame_ = (first_sample + n_fft / 2 + hop_length - 1) / hop_length;
+  next_frame_ = first_frame_;
+  started_ = true;
+}
+
+void MelRing::enqueue(const std::int16_t *data, std::size_t count, std::uint64_t first_sample) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if ( !started_ || first_sample > samples_written_ + capacity_frames_ * hop_length ) {
+    // Nothing to continue from (or nothing left of it after the gap)
+    reset_(first_sample);
+  } else if ( first_sample > samples_written_ ) {
+    samples_.resize(samples_.size() + (first_sample - samples_written_), 0.f);
+    samples_written_ = first_sample;
+  } else if ( first_sample < samples_written_ ) {
+    // Already have those
+    const std::size_t known = std::min<std::uint64_t>(samples_written_ - first_sample, count);
+    data += known;
+    count -= known;
+  }
+
+  const std::size_t offset = samples_.size();
+  samples_.resize(offset + count);
+  int16_to_float(data, samples_.data() + offset, count);
+  samples_written_ += count;
+
+  // Every frame whose window is complete
+  while ( (next_frame_ * hop_length + n_fft / 2) <= samples_written_ ) {
+    add_frame_();
+  }
+
+  // Drop the samples no frame needs anymore
+  const std::uint64_t needed = std::max<std::uint64_t>(next_frame_ * hop_length,
+                                                       n_fft / 2) - n_fft / 2;
+  if ( needed > samples_start_ ) {
+    const std::size_t drop = std::min<std::uint64_t>(needed - samples_start_, samples_.size());
+    samples_.erase(samples_.begin(), samples_.begin() + drop);
+    samples_start_ += drop;
+  }
+}
+
+void MelRing::add_frame_() {
+  // Window centered on the frame's sample, anything before the first sample is silence
+  const std::int64_t start = static_cast<std::int64_t>(next_frame_ * hop_length) -
+                             static_cast<std::int64_t>(n_fft / 2);
+  for (std::size_t i = 0; i < n_fft; ++i) {
+    const std::int64_t index = start + static_cast<std::int64_t>(i) -
+                               static_cast<std::int64_t>(samples_start_);
+    frame_[i] = index >= 0 ? samples_[index] * window_[i] : 0.f;
+  }
+  fft_.power_spectrum(frame_.data(), power_.data());
+
+  float *out = frames_.data() + (next_frame_ % capacity_frames_) * n_mels_;
+  for (std::size_t m = 0; m < n_mels_; ++m) {
+    const float *power = power_.data() + band_start_[m];
+    float sum = 0.f;
+    for (std::size_t k = 0; k < band_weights_[m].size(); ++k) {
+      sum += power[k] * band_weights_[m][k];
+    }
+    out[m] = std::log10(std::max(sum, 1e-10f));
+  }
+  ++next_frame_;
+  first_frame_ = std::max(first_frame_, next_frame_ - std::min<std::uint64_t>(next_frame_,
+                                                                              capacity_frames_));
+}
+
+std::uint64_t MelRing::peak_into(MelSpectrogram &out, std::uint64_t from_sample,
+                                 std::uint64_t to_sample) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Frames centered in [from_sample, to_sample)
+  const std::uint64_t first = std::min(std::max((from_sample + hop_length - 1) / hop_length,
+                                                first_frame_), next_frame_);
+  const std::uint64_t last = std::max(std::min((to_sample + hop_length - 1) / hop_length,
+                                               next_frame_), first);
+
+  out.n_mels = n_mels_;
+  out.n_len_org = last - first;
+  out.n_len = out.n_len_org + WHISPER_CHUNK_SIZE * WHISPER_SAMPLE_RATE / hop_length;
+  out.data.resize(out.n_mels * out.n_len);
+
+  // Whisper clamps to 80 dB below the loudest value and scales to about [-1, 1]
+  float max = min_log_power;
+  for (std::uint64_t f = first; f < last; ++f) {
+    const float *frame = frames_.data() + (f % capacity_frames_) * n_mels_;
+    max = std::max(max, *std::max_element(frame, frame + n_mels_));
+  }
+  const float floor = max - 8.f;
+  for (std::uint64_t f = first; f < last; ++f) {
+    const float *frame = frames_.data() + (f % capacity_frames_) * n_mels_;
+    for (std::size_t m = 0; m < n_mels_; ++m) {
+      out.data[m * out.n_len + (f - first)] = (std::max(frame[m], floor) + 4.f) / 4.f;
+    }
+  }
+  const float silence = (std::max(min_log_power, floor) + 4.f) / 4.f;
+  for (std::size_t m = 0; m < n_mels_; ++m) {
+    std::fill(out.data.begin() + m * out.n_len + out.n_len_org,
+              out.data.begin() + (m + 1) * out.n_len, silence);
+  }
+  return first * hop_length;
+}
+
+void MelRing::resize(const std::size_t &capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::size_t capacity_frames = std::max<std::size_t>(capacity / hop_length, 1);
+  first_frame_ = std::max(first_frame_, next_frame_ - std::min<std::uint64_t>(next_frame_,
+                                                                              capacity_frames));
+  std::vector<float> frames(capacity_frames * n_mels_);
+  for (std::uint64_t f = first_frame_; f < next_frame_; ++f) {
+    std::copy_n(frames_.begin() + (f % capacity_frames_) * n_mels_, n_mels_,
+                frames.begin() + (f % capacity_frames) * n_mels_);
+  }
+  frames_ = std::move(frames);
+  capacity_frames_ = capacity_frames;
+}
+
+} // end of namespace whisper
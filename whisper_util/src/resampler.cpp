@@ -0,0 +1,142 @@
+#include "whisper_util/resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace whisper {
+
+namespace {
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x) {
+  double sum = 1., term = 1.;
+  for (int k = 1; k < 32; ++k) {
+    term *= (x / (2. * k)) * (x / (2. * k));
+    sum += term;
+  }
+  return sum;
+}
+
+float dot_product(const float *a, const float *b, std::size_t n) {
+  std::size_t i = 0;
+  float result = 0.f;
+#if defined(__AVX2__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  result = _mm_cvtss_f32(sum);
+#elif defined(__SSE2__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  result = _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.f);
+  for (; i + 4 <= n; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  result = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+  for (; i < n; ++i) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+} // end of anonymous namespace
+
+Resampler::Resampler(const std::size_t &input_rate, const std::size_t &channels,
+                     const std::size_t &output_rate, const std::size_t &taps_per_phase)
+    : input_rate_(input_rate), channels_(std::max<std::size_t>(channels, 1)),
+      taps_(taps_per_phase) {
+  const std::size_t divisor = std::gcd(input_rate, output_rate);
+  up_ = output_rate / divisor;
+  down_ = input_rate / divisor;
+
+  // Prototype low-pass at the upsampled rate, cut off below the lower of both Nyquist rates
+  const std::size_t length = up_ * taps_;
+  const double cutoff = 0.45 / static_cast<double>(std::max(up_, down_));
+  const double beta = 8.;
+  const double center = 0.5 * static_cast<double>(length - 1);
+  std::vector<double> prototype(length);
+  for (std::size_t i = 0; i < length; ++i) {
+    const double t = static_cast<double>(i) - center;
+    const double sinc = t == 0. ? 2. * cutoff :
+                                  std::sin(2. * M_PI * cutoff * t) / (M_PI * t);
+    const double r = 2. * static_cast<double>(i) / static_cast<double>(length - 1) - 1.;
+    const double window = bessel_i0(beta * std::sqrt(std::max(0., 1. - r * r))) /
+                          bessel_i0(beta);
+    // Gain of up_ compensates for the zeros inserted by interpolation
+    prototype[i] = sinc * window * static_cast<double>(up_);
+  }
+
+  // Phase p uses prototype[p + k * up_], stored reversed for a forward dot product
+  coefficients_.resize(length);
+  for (std::size_t p = 0; p < up_; ++p) {
+    for (std::size_t k = 0; k < taps_; ++k) {
+      coefficients_[p * taps_ + (taps_ - 1 - k)] = static_cast<float>(prototype[p + k * up_]);
+    }
+  }
+  reset();
+}
+
+void Resampler::process(const std::int16_t *interleaved, std::size_t frames,
+                        std::vector<std::int16_t> &out) {
+  if ( is_passthrough() ) {
+    out.insert(out.end(), interleaved, interleaved + frames);
+    return;
+  }
+
+  // Downmix into the input history
+  const std::size_t offset = history_.size();
+  history_.resize(offset + frames);
+  const float scale = 1.f / static_cast<float>(channels_);
+  for (std::size_t i = 0; i < frames; ++i) {
+    int sum = 0;
+    for (std::size_t c = 0; c < channels_; ++c) {
+      sum += interleaved[i * channels_ + c];
+    }
+    history_[offset + i] = static_cast<float>(sum) * scale;
+  }
+
+  // Filter every output whose newest input sample is available
+  out.reserve(out.size() + frames * up_ / down_ + 1);
+  while ( next_ / up_ < history_.size() ) {
+    const std::size_t newest = next_ / up_;
+    const std::size_t phase = next_ % up_;
+    float y = dot_product(coefficients_.data() + phase * taps_,
+                          history_.data() + newest + 1 - taps_, taps_);
+    y = std::clamp(std::round(y), static_cast<float>(std::numeric_limits<std::int16_t>::min()),
+                   static_cast<float>(std::numeric_limits<std::int16_t>::max()));
+    out.push_back(static_cast<std::int16_t>(y));
+    next_ += down_;
+  }
+
+  // Keep taps_ - 1 samples of history for the next call
+  const std::size_t drop = history_.size() - (taps_ - 1);
+  history_.erase(history_.begin(), history_.begin() + drop);
+  next_ -= drop * up_;
+}
+
+void Resampler::reset() {
+  history_.assign(taps_ - 1, 0.f);
+  next_ = (taps_ - 1) * up_;
+}
+
+} // end of namespace whisper
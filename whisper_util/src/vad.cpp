@@ -0,0 +1,85 @@
+#include "whisper_util/vad.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace whisper {
+
+AudioBlock summarize_block(const std::int16_t *data, std::size_t count) {
+  AudioBlock block{0.f, 0.f, 0.f};
+  if ( count == 0 ) {
+    return block;
+  }
+  double energy = 0.;
+  std::size_t crossings = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    energy += static_cast<double>(data[i]) * data[i];
+    if ( i > 0 && ((data[i] >= 0) != (data[i - 1] >= 0)) ) {
+      ++crossings;
+    }
+  }
+  block.rms = static_cast<float>(std::sqrt(energy / count) /
+                                 std::numeric_limits<std::int16_t>::max());
+  block.zero_crossing_rate = static_cast<float>(crossings) / static_cast<float>(count);
+  return block;
+}
+
+bool is_speech(const AudioBlock &block, const VadThresholds &thresholds) {
+  if ( block.rms < thresholds.min_rms ) {
+    return false;
+  }
+  // Broadband noise crosses zero far more often than voiced speech
+  if ( block.zero_crossing_rate > thresholds.max_zero_crossing_rate ) {
+    return false;
+  }
+  return thresholds.min_spectral_flux <= 0.f ||
+         block.spectral_flux >= thresholds.min_spectral_flux;
+}
+
+float snr_db(const std::vector<AudioBlock> &blocks, std::vector<float> &scratch) {
+  if ( blocks.empty() ) {
+    return 0.f;
+  }
+  scratch.resize(blocks.size());
+  std::transform(blocks.begin(), blocks.end(), scratch.begin(),
+                 [](const AudioBlock &block) { return block.rms; });
+
+  // The quiet blocks are the noise floor, the loud ones the speaker
+  auto noise = scratch.begin() + scratch.size() / 10;
+  std::nth_element(scratch.begin(), noise, scratch.end());
+  const float noise_rms = *noise;
+  auto signal = scratch.begin() + scratch.size() * 9 / 10;
+  std::nth_element(noise, signal, scratch.end());
+  const float signal_rms = *signal;
+
+  // Floor at 1 LSB, digital silence would give infinite ratios
+  const float floor = 1.f / std::numeric_limits<std::int16_t>::max();
+  return 20.f * std::log10(std::max(signal_rms, floor) / std::max(noise_rms, floor));
+}
+
+SpectralFlux::SpectralFlux(const std::size_t &block_size)
+    : fft_(block_size), window_(block_size), input_(block_size),
+      magnitude_(fft_.bins()), previous_(fft_.bins(), 0.f) {
+  for (std::size_t i = 0; i < block_size; ++i) {
+    window_[i] = 0.5f * (1.f - std::cos(2.f * static_cast<float>(M_PI) * i / block_size));
+  }
+}
+
+float SpectralFlux::operator()(const std::int16_t *data) {
+  const float scale = 1.f / std::numeric_limits<std::int16_t>::max();
+  for (std::size_t i = 0; i < input_.size(); ++i) {
+    input_[i] = data[i] * scale * window_[i];
+  }
+  fft_.power_spectrum(input_.data(), magnitude_.data());
+
+  float flux = 0.f;
+  for (std::size_t k = 0; k < magnitude_.size(); ++k) {
+    magnitude_[k] = std::sqrt(magnitude_[k]);
+    flux += std::max(0.f, magnitude_[k] - previous_[k]);
+  }
+  previous_.swap(magnitude_);
+  return flux / static_cast<float>(previous_.size());
+}
+
+} // end of namespace whisper
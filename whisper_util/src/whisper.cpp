@@ -1,88 +1,388 @@
 #include "whisper_util/whisper.hpp"
 
+#include <algorithm>
+#include <map>
+#include <tuple>
+
 namespace whisper {
-Whisper::Whisper() { wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY); }
 
-Whisper::Whisper(const std::string &model_path) { initialize(model_path); }
+std::shared_ptr<whisper_context> get_model_context(const std::string &model_path,
+                                                   const whisper_context_params &cparams) {
+  using Key = std::tuple<std::string, bool, bool, int>;
+  static std::mutex registry_mutex;
+  static std::map<Key, std::weak_ptr<whisper_context>> registry;
+
+  // Loaded without a state, every Whisper brings its own
+  const Key key{model_path, cparams.use_gpu, cparams.flash_attn, cparams.gpu_device};
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto model = registry[key].lock();
+  if ( !model ) {
+    whisper_context *ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(),
+                                                                       cparams);
+    if ( !ctx ) {
+      throw std::runtime_error("Failed to load model " + model_path + ".");
+    }
+    model = std::shared_ptr<whisper_context>(ctx, whisper_free);
+    registry[key] = model;
+  }
+  return model;
+}
+
+bool has_repetition(const std::vector<whisper_token> &tokens, std::size_t max_length,
+                    std::size_t min_repeats) {
+  // A phrase of length n repeated r times is a run of (r - 1) * n tokens equal to the one n back
+  for (std::size_t n = 1; n <= max_length; ++n) {
+    std::size_t run = 0;
+    for (std::size_t i = n; i < tokens.size(); ++i) {
+      run = tokens[i] == tokens[i - n] ? run + 1 : 0;
+      if ( run >= (min_repeats - 1) * n ) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
-Whisper::~Whisper() { whisper_free(ctx); }
+bool Deadline::expired() const {
+  return (latest && latest->load(std::memory_order_relaxed) > generation) ||
+         (time != std::chrono::steady_clock::time_point::max() &&
+          std::chrono::steady_clock::now() >= time);
+}
+
+Whisper::Whisper()
+    : ctx(nullptr), audio_ctx_granularity(0), audio_ctx_margin(0), audio_ctx_fallbacks(0) {
+  wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+  cparams = whisper_context_default_params();
+}
+
+Whisper::Whisper(const std::string &model_path) : Whisper() { initialize(model_path); }
+
+Whisper::~Whisper() { free_states_(); }
 
 void Whisper::initialize(const std::string &model_path) {
-  ctx = whisper_init_from_file_with_params(model_path.c_str(), cparams);
+  free_states_();
+  model_ = get_model_context(model_path, cparams);
+  ctx = model_.get();
+}
+
+whisper_state *Whisper::acquire_state_() {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if ( !idle_states_.empty() ) {
+      whisper_state *state = idle_states_.back();
+      idle_states_.pop_back();
+      return state;
+    }
+  }
+  // Allocating the KV cache takes a while, outside the lock
+  whisper_state *state = whisper_init_state(ctx);
+  if ( !state ) {
+    throw std::runtime_error("Failed to allocate a whisper state.");
+  }
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  states_.push_back(state);
+  return state;
+}
+
+void Whisper::release_state_(whisper_state *state) {
+  std::vector<whisper_token> tokens;
+  const int n_segments = whisper_full_n_segments_from_state(state);
+  for (int i = 0; i < n_segments; ++i) {
+    const int token_count = whisper_full_n_tokens_from_state(state, i);
+    for (int j = 0; j < token_count; ++j) {
+      tokens.push_back(whisper_full_get_token_id_from_state(state, i, j));
+    }
+  }
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  idle_states_.push_back(state);
+  last_tokens_ = std::move(tokens);
+}
+
+void Whisper::free_states_() {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  for (auto state : states_) {
+    whisper_free_state(state);
+  }
+  states_.clear();
+  idle_states_.clear();
+  last_tokens_.clear();
+}
+
+int Whisper::audio_ctx_for_(std::size_t samples) const {
+  const int full_ctx = whisper_model_n_audio_ctx(ctx);
+  if ( audio_ctx_granularity <= 0 ) {
+    return 0;
+  }
+  // The encoder produces a frame per two mel frames
+  const int frames = (samples + 2 * WHISPER_HOP_LENGTH - 1) / (2 * WHISPER_HOP_LENGTH) +
+                     audio_ctx_margin;
+  const int rounded = (frames + audio_ctx_granularity - 1) / audio_ctx_granularity *
+                      audio_ctx_granularity;
+  return rounded >= full_ctx ? 0 : rounded;
+}
+
+bool Whisper::is_degenerate_(whisper_state *state, bool speech) const {
+  const whisper_token eot = whisper_token_eot(ctx);
+  std::vector<whisper_token> text;
+  const int n_segments = whisper_full_n_segments_from_state(state);
+  for (int i = 0; i < n_segments; ++i) {
+    const int token_count = whisper_full_n_tokens_from_state(state, i);
+    for (int j = 0; j < token_count; ++j) {
+      const whisper_token token = whisper_full_get_token_id_from_state(state, i, j);
+      if ( token < eot ) {
+        text.push_back(token);
+      }
+    }
+  }
+  // Silence legitimately decodes to nothing
+  return (speech && text.empty()) || has_repetition(text);
+}
+
+int Whisper::full_(whisper_state *state, const float *samples, std::size_t n_samples,
+                   std::size_t window_samples, const Deadline &deadline, Serialized *out,
+                   const SegmentCallback &on_segment,
+                   const std::vector<whisper_token> &prompt, bool speech) {
+  whisper_full_params params;
+  {
+    std::lock_guard<std::mutex> lock(wparams_mutex_);
+    params = wparams;
+  }
+  if ( !prompt.empty() ) {
+    params.prompt_tokens = prompt.data();
+    params.prompt_n_tokens = prompt.size();
+  }
+  params.abort_callback = [](void *data) {
+    return static_cast<const Deadline *>(data)->expired();
+  };
+  params.abort_callback_user_data = const_cast<Deadline *>(&deadline);
+  params.audio_ctx = audio_ctx_for_(window_samples);
+  if ( !samples ) {
+    // The spectrogram ends in padding, which is not worth decoding
+    params.offset_ms = 0;
+    params.duration_ms = std::max<std::size_t>(window_samples * 1000 / WHISPER_SAMPLE_RATE, 1);
+  }
+
+  // whisper hands the running hypothesis to logits_filter_callback before every decoder step,
+  //    on this thread.  new_segment_callback would only fire once the whole window is decoded.
+  struct Partial {
+    Whisper *whisper;
+    Serialized *out;
+    const SegmentCallback *on_segment;
+    std::int64_t offset;  // 10 ms, where the first seek window starts
+    int n_tokens;         // longest sequence seen in the current decoding pass
+  } partial{this, out, &on_segment, params.offset_ms / 10, 0};
+  auto stream_partials = [&params, &partial]() {
+    params.logits_filter_callback = [](whisper_context *ctx, whisper_state *state,
+                                       const whisper_token_data *tokens, int n_tokens, float *,
+                                       void *data) {
+      auto *partial = static_cast<Partial *>(data);
+      // Called for every decoder at every step and from scratch for every seek window or
+      //    temperature fallback, the first decoder to get one token further speaks for the step
+      if ( n_tokens <= partial->n_tokens ) {
+        if ( n_tokens == 0 ) {
+          partial->n_tokens = 0;
+        }
+        return;
+      }
+      partial->n_tokens = n_tokens;
+
+      // Only when the newest token closes a segment
+      const whisper_token beg = whisper_token_beg(ctx);
+      if ( n_tokens < 2 || tokens[n_tokens - 1].id <= beg ||
+           tokens[n_tokens - 2].id >= whisper_token_eot(ctx) ) {
+        return;
+      }
+      partial->whisper->serialize_hypothesis_(state, tokens, n_tokens, partial->offset,
+                                              *partial->out);
+      (*partial->on_segment)();
+    };
+    params.logits_filter_callback_user_data = &partial;
+  };
+
+  // Partials of a shortened context may still be thrown away, stream only those of the pass
+  //    whose result counts
+  const bool partials = out && on_segment;
+  if ( partials && params.audio_ctx == 0 ) {
+    stream_partials();
+  }
+  const int status = whisper_full_with_state(ctx, state, params, samples, n_samples);
+  if ( status != 0 || params.audio_ctx == 0 || !is_degenerate_(state, speech) || deadline.expired() ) {
+    return status;
+  }
+
+  // The shortened context may be what broke the result, try again with all of it
+  ++audio_ctx_fallbacks;
+  params.audio_ctx = 0;
+  if ( partials ) {
+    stream_partials();
+  }
+  return whisper_full_with_state(ctx, state, params, samples, n_samples);
 }
 
 std::string Whisper::forward(const std::vector<float> &input) {
-  if ( whisper_full(ctx, wparams, input.data(), input.size()) != 0 ) {
+  whisper_state *state = acquire_state_();
+  if ( full_(state, input.data(), input.size(), input.size()) != 0 ) {
+    release_state_(state);
     return {};
   }
   std::vector<std::string> segments;
-  int n_segments = whisper_full_n_segments(ctx);
+  int n_segments = whisper_full_n_segments_from_state(state);
   for (int i = 0; i < n_segments; ++i) {
-    segments.push_back(whisper_full_get_segment_text(ctx, i));
+    segments.push_back(whisper_full_get_segment_text_from_state(state, i));
   }
+  release_state_(state);
   return std::accumulate(segments.begin(), segments.end(), std::string());
 }
 
 std::vector<whisper_token> Whisper::tokens() {
-  std::vector<whisper_token> tokens;
-  const int n_segments = whisper_full_n_segments(ctx);
-  for (int i = 0; i < n_segments; ++i) {
-    const int token_count = whisper_full_n_tokens(ctx, i);
-    for (int j = 0; j < token_count; ++j) {
-      tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-    }
-  }
-  return tokens;
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  return last_tokens_;
+}
+
+void Whisper::set_n_threads(int n_threads) {
+  std::lock_guard<std::mutex> lock(wparams_mutex_);
+  wparams.n_threads = n_threads;
 }
 
 
-void Whisper::forward_serialize(
+bool Whisper::forward_serialize(
                   const std::vector<float> &input,
                   std::vector<int> &token_ids,
                   std::vector<std::string> &token_texts,
                   std::vector<float> &token_probs,
                   std::vector<int> &segment_start_token_idx,
                   std::vector<int64_t> &segment_start_timestamp,
-                  std::vector<int64_t> &segment_end_timestamp
+                  std::vector<int64_t> &segment_end_timestamp,
+                  const Deadline &deadline,
+                  const SegmentCallback &on_segment,
+                  const std::vector<whisper_token> &prompt,
+                  bool speech
                 ) {
   // Perform whisper inference
-  if ( whisper_full(ctx, wparams, input.data(), input.size()) != 0 ) {
-    return;
+  Serialized out{token_ids, token_texts, token_probs, segment_start_token_idx,
+                 segment_start_timestamp, segment_end_timestamp};
+  whisper_state *state = acquire_state_();
+  if ( full_(state, input.data(), input.size(), input.size(), deadline, &out, on_segment,
+             prompt, speech) != 0 ) {
+    release_state_(state);
+    out.clear();
+    return false;
+  }
+  // Replace the last partial hypothesis by the result
+  out.clear();
+  serialize_(state, out);
+  release_state_(state);
+  return true;
+}
+
+bool Whisper::forward_serialize(
+                  const MelSpectrogram &mel,
+                  std::vector<int> &token_ids,
+                  std::vector<std::string> &token_texts,
+                  std::vector<float> &token_probs,
+                  std::vector<int> &segment_start_token_idx,
+                  std::vector<int64_t> &segment_start_timestamp,
+                  std::vector<int64_t> &segment_end_timestamp,
+                  const Deadline &deadline,
+                  const SegmentCallback &on_segment,
+                  const std::vector<whisper_token> &prompt,
+                  bool speech
+                ) {
+  // Perform whisper inference on the spectrogram, whisper_full skips its front end without samples
+  Serialized out{token_ids, token_texts, token_probs, segment_start_token_idx,
+                 segment_start_timestamp, segment_end_timestamp};
+  whisper_state *state = acquire_state_();
+  if ( whisper_set_mel_with_state(ctx, state, mel.data.data(), mel.n_len, mel.n_mels) != 0 ||
+       full_(state, nullptr, 0, mel.n_len_org * WHISPER_HOP_LENGTH, deadline, &out,
+             on_segment, prompt, speech) != 0 ) {
+    release_state_(state);
+    out.clear();
+    return false;
   }
+  // Replace the last partial hypothesis by the result
+  out.clear();
+  serialize_(state, out);
+  release_state_(state);
+  return true;
+}
+
+void Whisper::Serialized::clear() {
+  token_ids.clear();
+  token_texts.clear();
+  token_probs.clear();
+  segment_start_token_idx.clear();
+  segment_start_timestamp.clear();
+  segment_end_timestamp.clear();
+}
 
+void Whisper::serialize_(whisper_state *state, Serialized &out) {
   // Calculate the total number of tokens across all segments
-  int total_tokens = 0;
-  int n_segments = whisper_full_n_segments(ctx);
+  int total_tokens = out.token_ids.size();
+  const int n_segments = whisper_full_n_segments_from_state(state);
   for (int i = 0; i < n_segments; ++i) {
-    total_tokens += whisper_full_n_tokens(ctx, i);
+    total_tokens += whisper_full_n_tokens_from_state(state, i);
   }
 
   // Reserve memory for vectors to avoid reallocations
-  token_ids.reserve(total_tokens);
-  token_texts.reserve(total_tokens);
-  token_probs.reserve(total_tokens);
-  segment_start_token_idx.reserve(n_segments);
-  segment_start_timestamp.reserve(n_segments);
-  segment_end_timestamp.reserve(n_segments);
+  out.token_ids.reserve(total_tokens);
+  out.token_texts.reserve(total_tokens);
+  out.token_probs.reserve(total_tokens);
+  out.segment_start_token_idx.reserve(out.segment_start_token_idx.size() + n_segments);
+  out.segment_start_timestamp.reserve(out.segment_start_timestamp.size() + n_segments);
+  out.segment_end_timestamp.reserve(out.segment_end_timestamp.size() + n_segments);
 
   // Load data
-  int segment_start_token_counter = 0;
+  int segment_start_token_counter = out.token_ids.size();
   for (int i = 0; i < n_segments; ++i) {
-    segment_start_token_idx.push_back(segment_start_token_counter);
-    segment_start_timestamp.push_back(whisper_full_get_segment_t0(ctx, i));
-    segment_end_timestamp.push_back(whisper_full_get_segment_t1(ctx, i));
+    out.segment_start_token_idx.push_back(segment_start_token_counter);
+    out.segment_start_timestamp.push_back(whisper_full_get_segment_t0_from_state(state, i));
+    out.segment_end_timestamp.push_back(whisper_full_get_segment_t1_from_state(state, i));
 
     // Get token level data
-    const int token_count = whisper_full_n_tokens(ctx, i);
+    const int token_count = whisper_full_n_tokens_from_state(state, i);
     for (int j = 0; j < token_count; ++j) {
-      token_ids.push_back(whisper_full_get_token_id(ctx, i, j));
-      token_texts.push_back(whisper_full_get_token_text(ctx, i, j));
-      token_probs.push_back(whisper_full_get_token_p(ctx, i, j));
+      out.token_ids.push_back(whisper_full_get_token_id_from_state(state, i, j));
+      out.token_texts.push_back(whisper_full_get_token_text_from_state(ctx, state, i, j));
+      out.token_probs.push_back(whisper_full_get_token_p_from_state(state, i, j));
       segment_start_token_counter++;
     }
   }
 }
 
+void Whisper::serialize_hypothesis_(whisper_state *state, const whisper_token_data *tokens,
+                                    int n_tokens, std::int64_t offset, Serialized &out) {
+  // Segments of finished seek windows, the next seek window starts where the last one ended
+  out.clear();
+  serialize_(state, out);
+  if ( !out.segment_end_timestamp.empty() ) {
+    offset = out.segment_end_timestamp.back();
+  }
 
+  // Split as whisper_full does:  A segment runs from the token after the previous segment up to
+  //    the first timestamp that follows text, timestamps count 20 ms from the seek window start
+  const whisper_token eot = whisper_token_eot(ctx);
+  const whisper_token beg = whisper_token_beg(ctx);
+  std::int64_t t0 = offset;
+  int segment_start = 0;
+  bool has_text = false;
+  for (int i = 0; i < n_tokens; ++i) {
+    const whisper_token id = tokens[i].id;
+    if ( id >= beg && !has_text ) {
+      t0 = offset + 2 * (id - beg);
+    } else if ( id > beg ) {
+      out.segment_start_token_idx.push_back(out.token_ids.size());
+      out.segment_start_timestamp.push_back(t0);
+      out.segment_end_timestamp.push_back(offset + 2 * (id - beg));
+      for (int j = segment_start; j <= i; ++j) {
+        out.token_ids.push_back(tokens[j].id);
+        out.token_texts.push_back(whisper_token_to_str(ctx, tokens[j].id));
+        out.token_probs.push_back(tokens[j].p);
+      }
+      segment_start = i + 1;
+      has_text = false;
+    }
+    has_text = has_text || id < eot;
+  }
+}
 
 } // end of namespace whisper
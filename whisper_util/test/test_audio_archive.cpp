@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "whisper_util/audio_archive.hpp"
+
+using namespace std::chrono_literals;
+using whisper::AudioArchive;
+
+namespace {
+const auto t0 = std::chrono::system_clock::time_point(1700000000s);
+
+// Samples counting up from first, wrapping at int16
+std::vector<std::int16_t> ramp(const std::uint64_t &first, const std::size_t &count) {
+  std::vector<std::int16_t> data(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    data[i] = static_cast<std::int16_t>((first + i) % 32768);
+  }
+  return data;
+}
+
+float as_float(const std::uint64_t &index) {
+  return static_cast<float>(index % 32768) /
+         static_cast<float>(std::numeric_limits<std::int16_t>::max());
+}
+
+class AudioArchiveTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 (std::string("whisper_util_test_archive_") +
+                  ::testing::UnitTest::GetInstance()->current_test_info()->name());
+    std::filesystem::remove_all(directory_);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory_);
+  }
+
+  std::size_t segment_files() const {
+    std::size_t count = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(directory_)) {
+      count += entry.path().extension() == ".pcm";
+    }
+    return count;
+  }
+
+  // Append seconds of 100 ms chunks starting at stamp, continuing the ramp at first
+  static void append(AudioArchive &archive, std::chrono::system_clock::time_point stamp,
+                     const std::uint64_t &first, const std::size_t &seconds) {
+    for (std::size_t i = 0; i < seconds * 10; ++i) {
+      const auto chunk = ramp(first + i * 1600, 1600);
+      archive.append(chunk.data(), chunk.size(), stamp + i * 100ms);
+    }
+  }
+
+  std::filesystem::path directory_;
+};
+} // end of anonymous namespace
+
+TEST_F(AudioArchiveTest, ReadBack) {
+  AudioArchive archive(directory_.string(), 2s, 10);
+  std::vector<float> out;
+  EXPECT_EQ(archive.read(t0, t0 + 1s, out), t0);
+  EXPECT_TRUE(out.empty());
+
+  append(archive, t0, 0, 5);
+  EXPECT_EQ(archive.oldest(), t0);
+  EXPECT_EQ(archive.newest(), t0 + 5s);
+
+  // Across segment boundaries
+  const auto stamp = archive.read(t0 + 1500ms, t0 + 4500ms, out);
+  EXPECT_EQ(stamp, t0 + 1500ms);
+  ASSERT_EQ(out.size(), 48000u);
+  for (std::size_t i = 0; i < out.size(); ++i) {
+    ASSERT_FLOAT_EQ(out[i], as_float(24000 + i));
+  }
+
+  // Empty and inverted ranges
+  archive.read(t0 + 2s, t0 + 2s, out);
+  EXPECT_TRUE(out.empty());
+  archive.read(t0 + 3s, t0 + 2s, out);
+  EXPECT_TRUE(out.empty());
+}
+
+TEST_F(AudioArchiveTest, ClampsToArchivedRange) {
+  AudioArchive archive(directory_.string(), 2s, 10);
+  append(archive, t0, 0, 2);
+  std::vector<float> out;
+  const auto stamp = archive.read(t0 - 10s, t0 + 10s, out);
+  EXPECT_EQ(stamp, t0);
+  EXPECT_EQ(out.size(), 32000u);
+}
+
+TEST_F(AudioArchiveTest, FollowsJumps) {
+  AudioArchive archive(directory_.string(), 10s, 10);
+  append(archive, t0, 0, 2);
+  // The source paused for a minute
+  append(archive, t0 + 62s, 32000, 2);
+  EXPECT_EQ(archive.newest(), t0 + 64s);
+
+  std::vector<float> out;
+  auto stamp = archive.read(t0 + 62s, t0 + 63s, out);
+  EXPECT_EQ(stamp, t0 + 62s);
+  ASSERT_EQ(out.size(), 16000u);
+  EXPECT_FLOAT_EQ(out.front(), as_float(32000));
+  EXPECT_FLOAT_EQ(out.back(), as_float(47999));
+
+  // The pause itself holds no audio
+  archive.read(t0 + 10s, t0 + 20s, out);
+  EXPECT_TRUE(out.empty());
+}
+
+TEST_F(AudioArchiveTest, ClockStepsBack) {
+  AudioArchive archive(directory_.string(), 10s, 10);
+  append(archive, t0, 0, 2);
+  // Archived as continuing the stream, the index stays sorted
+  append(archive, t0 - 30s, 32000, 1);
+  EXPECT_EQ(archive.newest(), t0 + 3s);
+
+  std::vector<float> out;
+  archive.read(t0, t0 + 3s, out);
+  ASSERT_EQ(out.size(), 48000u);
+  EXPECT_FLOAT_EQ(out.back(), as_float(47999));
+}
+
+TEST_F(AudioArchiveTest, DeletesOldestSegments) {
+  AudioArchive archive(directory_.string(), 1s, 3);
+  append(archive, t0, 0, 6);
+  EXPECT_EQ(segment_files(), 3u);
+  EXPECT_EQ(archive.oldest(), t0 + 3s);
+
+  std::vector<float> out;
+  const auto stamp = archive.read(t0, t0 + 6s, out);
+  EXPECT_EQ(stamp, t0 + 3s);
+  ASSERT_EQ(out.size(), 48000u);
+  EXPECT_FLOAT_EQ(out.front(), as_float(48000));
+}
+
+TEST_F(AudioArchiveTest, BoundedAcrossRestarts) {
+  auto stamp = t0;
+  for (int run = 0; run < 3; ++run) {
+    AudioArchive archive(directory_.string(), 1s, 3);
+    append(archive, stamp, 0, 4);
+    stamp += 4s;
+    EXPECT_LE(segment_files(), 3u);
+  }
+  // The newest segments survive
+  EXPECT_TRUE(std::filesystem::exists(
+                directory_ / ("segment_" + std::to_string(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                    (stamp - 1s).time_since_epoch()).count()) + ".pcm")));
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+
+#include "whisper_util/audio_codec.hpp"
+
+using whisper::AudioEncoder;
+using whisper::decode_audio;
+
+namespace {
+std::vector<std::int16_t> sine(const std::size_t &frames, const std::size_t &channels) {
+  std::vector<std::int16_t> data(frames * channels);
+  for (std::size_t i = 0; i < frames; ++i) {
+    for (std::size_t c = 0; c < channels; ++c) {
+      data[i * channels + c] = static_cast<std::int16_t>(
+                  8000. * std::sin(0.05 * static_cast<double>(i) * static_cast<double>(c + 1)));
+    }
+  }
+  return data;
+}
+
+std::vector<std::int16_t> noise(const std::size_t &count) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(std::numeric_limits<std::int16_t>::min(),
+                                                  std::numeric_limits<std::int16_t>::max());
+  std::vector<std::int16_t> data(count);
+  for (auto &sample : data) {
+    sample = static_cast<std::int16_t>(distribution(generator));
+  }
+  return data;
+}
+
+// Encode and decode, the result has to be bit-exact
+std::size_t round_trip(const std::vector<std::int16_t> &data, const std::size_t &channels) {
+  AudioEncoder encoder;
+  std::vector<std::uint8_t> encoded;
+  const std::size_t frames = data.size() / channels;
+  const std::size_t bytes = encoder.encode(data.data(), frames, channels, encoded);
+  EXPECT_EQ(bytes, encoded.size());
+
+  std::vector<std::int16_t> decoded(data.size());
+  EXPECT_TRUE(decode_audio(encoded.data(), encoded.size(), frames, channels, decoded.data()));
+  EXPECT_EQ(decoded, data);
+  return bytes;
+}
+} // end of anonymous namespace
+
+TEST(AudioCodec, Silence) {
+  const std::vector<std::int16_t> data(1600, 0);
+  EXPECT_LT(round_trip(data, 1), data.size() * sizeof(std::int16_t) / 4);
+}
+
+TEST(AudioCodec, Sine) {
+  const auto data = sine(1600, 1);
+  EXPECT_LT(round_trip(data, 1), data.size() * sizeof(std::int16_t) / 2);
+}
+
+TEST(AudioCodec, Stereo) {
+  round_trip(sine(1000, 2), 2);
+}
+
+TEST(AudioCodec, NoiseIsStoredVerbatim) {
+  const auto data = noise(1600);
+  EXPECT_LE(round_trip(data, 1), data.size() * sizeof(std::int16_t) + 1);
+}
+
+TEST(AudioCodec, ExtremeValues) {
+  std::vector<std::int16_t> data(1000);
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    data[i] = i % 2 ? std::numeric_limits<std::int16_t>::max()
+                    : std::numeric_limits<std::int16_t>::min();
+  }
+  round_trip(data, 1);
+}
+
+TEST(AudioCodec, ShortChunks) {
+  for (std::size_t frames = 0; frames <= AudioEncoder::max_order + 2; ++frames) {
+    round_trip(sine(frames, 1), 1);
+  }
+  // Partition boundaries
+  round_trip(sine(AudioEncoder::partition_size + AudioEncoder::max_order, 1), 1);
+  round_trip(sine(AudioEncoder::partition_size * 3 + 1, 1), 1);
+}
+
+TEST(AudioCodec, EncoderAppends) {
+  AudioEncoder encoder;
+  std::vector<std::uint8_t> encoded{0xAB};
+  const auto data = sine(500, 1);
+  const std::size_t bytes = encoder.encode(data.data(), 500, 1, encoded);
+  EXPECT_EQ(encoded.size(), bytes + 1);
+  EXPECT_EQ(encoded[0], 0xAB);
+
+  std::vector<std::int16_t> decoded(500);
+  EXPECT_TRUE(decode_audio(encoded.data() + 1, bytes, 500, 1, decoded.data()));
+  EXPECT_EQ(decoded, data);
+}
+
+TEST(AudioCodec, RejectsCorruptData) {
+  AudioEncoder encoder;
+  std::vector<std::uint8_t> encoded;
+  const auto data = sine(1600, 1);
+  encoder.encode(data.data(), 1600, 1, encoded);
+  std::vector<std::int16_t> decoded(1600);
+
+  // Truncated
+  EXPECT_FALSE(decode_audio(encoded.data(), encoded.size() / 2, 1600, 1, decoded.data()));
+  EXPECT_FALSE(decode_audio(encoded.data(), 0, 1600, 1, decoded.data()));
+  // More frames than were encoded
+  std::vector<std::int16_t> longer(3200);
+  EXPECT_FALSE(decode_audio(encoded.data(), encoded.size(), 3200, 1, longer.data()));
+  // An order that does not exist
+  encoded[0] = 0xC0;  // order 6
+  EXPECT_FALSE(decode_audio(encoded.data(), encoded.size(), 1600, 1, decoded.data()));
+}
+
+TEST(AudioCodec, FixedResidualSums) {
+  const auto data = sine(1000, 1);
+  std::vector<std::int32_t> x(data.begin(), data.end());
+  const auto sums = whisper::fixed_residual_sums(x.data(), x.size());
+
+  // Scalar reference: residual of order o is the o-th difference
+  constexpr std::size_t max_order = AudioEncoder::max_order;
+  for (std::size_t order = 0; order <= max_order; ++order) {
+    std::vector<std::int64_t> diff(x.begin(), x.end());
+    for (std::size_t o = 0; o < order; ++o) {
+      for (std::size_t i = diff.size() - 1; i > 0; --i) {
+        diff[i] -= diff[i - 1];
+      }
+    }
+    std::uint64_t sum = 0;
+    for (std::size_t i = max_order; i < diff.size(); ++i) {
+      sum += static_cast<std::uint64_t>(std::llabs(diff[i]));
+    }
+    EXPECT_EQ(sums[order], sum) << "order " << order;
+  }
+}
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <thread>
+
+#include "whisper_util/audio_buffers.hpp"
+
+using namespace std::chrono_literals;
+using whisper::AudioRing;
+
+namespace {
+const auto t0 = std::chrono::system_clock::time_point(1700000000s);
+
+// Samples counting up from first, wrapping at int16
+std::vector<std::int16_t> ramp(const std::uint64_t &first, const std::size_t &count) {
+  std::vector<std::int16_t> data(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    data[i] = static_cast<std::int16_t>((first + i) % 32768);
+  }
+  return data;
+}
+
+float as_float(const std::uint64_t &index) {
+  return static_cast<float>(index % 32768) /
+         static_cast<float>(std::numeric_limits<std::int16_t>::max());
+}
+} // end of anonymous namespace
+
+TEST(AudioRing, StartsWithSilence) {
+  AudioRing ring(1000ms, t0);
+  EXPECT_TRUE(ring.is_full());
+  EXPECT_TRUE(ring.is_audio_start_set());
+  // The end of the buffer is at the time it was created
+  EXPECT_EQ(ring.sample_time(ring.samples_written()), t0);
+
+  auto [audio, stamp] = ring.peak();
+  ASSERT_EQ(audio.size(), 16000u);
+  EXPECT_EQ(stamp, t0 - 1s);
+  for (const auto &sample : audio) {
+    ASSERT_FLOAT_EQ(sample, 0.f);
+  }
+}
+
+TEST(AudioRing, DropsOldestWhenFull) {
+  AudioRing ring(1000ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  // Several times the capacity, in chunks that don't divide the storage size
+  std::uint64_t written = 0;
+  while ( written < 5 * 16000 ) {
+    ring.enqueue(ramp(written, 1234));
+    written += 1234;
+  }
+  EXPECT_EQ(ring.samples_written(), base + written);
+  EXPECT_EQ(ring.size(), ring.capacity());
+
+  std::vector<float> audio;
+  std::uint64_t first_sample;
+  const auto stamp = ring.peak_into(audio, &first_sample);
+  ASSERT_EQ(audio.size(), 16000u);
+  EXPECT_EQ(first_sample, base + written - 16000);
+  for (std::size_t i = 0; i < audio.size(); ++i) {
+    ASSERT_FLOAT_EQ(audio[i], as_float(first_sample - base + i));
+  }
+  // Timestamps follow the sample counter, not the number of drops
+  EXPECT_EQ(stamp, t0 + whisper::count_to_time_ns(first_sample - base));
+  EXPECT_EQ(ring.get_start_timestamp(), stamp);
+}
+
+TEST(AudioRing, PeakIntoFromSample) {
+  AudioRing ring(1000ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  ring.enqueue(ramp(0, 8000));
+  std::vector<float> audio;
+  std::uint64_t first_sample;
+  const auto stamp = ring.peak_into(audio, &first_sample, base + 3000);
+  EXPECT_EQ(first_sample, base + 3000);
+  ASSERT_EQ(audio.size(), 5000u);
+  EXPECT_FLOAT_EQ(audio.front(), as_float(3000));
+  EXPECT_FLOAT_EQ(audio.back(), as_float(7999));
+  EXPECT_EQ(stamp, t0 + whisper::count_to_time_ns(3000));
+
+  // Nothing after the end
+  ring.peak_into(audio, &first_sample, base + 9000);
+  EXPECT_TRUE(audio.empty());
+}
+
+TEST(AudioRing, Decay) {
+  AudioRing ring(1000ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  ring.enqueue(ramp(1, 1600));
+  // The buffer ends 100 ms after t0, pad another 100 ms of silence
+  EXPECT_EQ(ring.decay(t0 + 200ms), 1600u);
+  EXPECT_EQ(ring.samples_written(), base + 3200);
+  EXPECT_EQ(ring.decay(t0 + 100ms), 0u);
+
+  std::vector<float> audio;
+  ring.peak_into(audio, nullptr, base);
+  ASSERT_EQ(audio.size(), 3200u);
+  EXPECT_FLOAT_EQ(audio[1599], as_float(1600));
+  EXPECT_FLOAT_EQ(audio[1600], 0.f);
+  EXPECT_FLOAT_EQ(audio.back(), 0.f);
+}
+
+TEST(AudioRing, SetStartTimestamp) {
+  AudioRing ring(1000ms);
+  EXPECT_FALSE(ring.is_audio_start_set());
+  ring.enqueue(ramp(0, 1600));
+  ring.set_start_timestamp(t0);
+  EXPECT_TRUE(ring.is_audio_start_set());
+  EXPECT_EQ(ring.sample_time(ring.samples_written()), t0);
+
+  ring.adjust_timestamps(5ms);
+  EXPECT_EQ(ring.sample_time(ring.samples_written()), t0 + 5ms);
+}
+
+TEST(AudioRing, Resize) {
+  AudioRing ring(1000ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  ring.enqueue(ramp(0, 16000));
+  ring.resize(500ms);
+  ring.enqueue(ramp(16000, 160));
+  EXPECT_EQ(ring.capacity(), 8000u);
+
+  std::vector<float> audio;
+  std::uint64_t first_sample;
+  ring.peak_into(audio, &first_sample);
+  ASSERT_EQ(audio.size(), 8000u);
+  EXPECT_EQ(first_sample, base + 16160 - 8000);
+  for (std::size_t i = 0; i < audio.size(); ++i) {
+    ASSERT_FLOAT_EQ(audio[i], as_float(first_sample - base + i));
+  }
+}
+
+TEST(AudioRing, ConcurrentProducerConsumer) {
+  AudioRing ring(200ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  constexpr std::uint64_t total = 40 * 16000;
+  std::atomic<bool> done(false);
+
+  std::thread producer([&ring, &done]() {
+    for (std::uint64_t written = 0; written < total; written += 160) {
+      ring.enqueue(ramp(written, 160));
+    }
+    done = true;
+  });
+
+  // Whatever the consumer sees must be in order and stamped with its own position
+  std::vector<float> audio;
+  std::uint64_t first_sample;
+  bool consistent = true;
+  while ( !done && consistent ) {
+    const auto stamp = ring.peak_into(audio, &first_sample, base);
+    for (std::size_t i = 0; i < audio.size() && consistent; ++i) {
+      consistent = std::abs(audio[i] - as_float(first_sample - base + i)) < 1e-6f;
+    }
+    if ( !audio.empty() ) {
+      consistent = consistent &&
+                   stamp == t0 + whisper::count_to_time_ns(first_sample - base);
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(consistent);
+  EXPECT_EQ(ring.samples_written(), base + total);
+}
+
+TEST(AudioRing, PeakRange) {
+  AudioRing ring(1000ms, t0);
+  const std::uint64_t base = ring.samples_written();
+  ring.enqueue(ramp(0, 8000));
+
+  std::vector<float> audio;
+  std::uint64_t first_sample, peaked_first, end_sample;
+  for (const std::uint64_t from : {std::uint64_t(0), base + 3000, base + 9000}) {
+    ring.peak_into(audio, &peaked_first, from);
+    ring.peak_range(first_sample, end_sample, from);
+    EXPECT_EQ(first_sample, peaked_first);
+    EXPECT_EQ(end_sample, peaked_first + audio.size());
+  }
+}
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include "whisper_util/jitter_buffer.hpp"
+
+using namespace std::chrono_literals;
+using whisper::JitterBuffer;
+
+namespace {
+const auto t0 = std::chrono::system_clock::time_point(1700000000s);
+
+// 100 ms chunks of 16 kHz mono, the first sample holds the sequence
+JitterBuffer::Chunk make_chunk(const std::uint64_t &sequence,
+                               std::chrono::system_clock::time_point stamp) {
+  return {sequence, stamp, 16000, 1,
+          std::vector<std::int16_t>(1600, static_cast<std::int16_t>(sequence))};
+}
+
+JitterBuffer::Chunk make_chunk(const std::uint64_t &sequence) {
+  return make_chunk(sequence, t0 + sequence * 100ms);
+}
+} // end of anonymous namespace
+
+TEST(JitterBuffer, InOrder) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  for (std::uint64_t i = 0; i < 5; ++i) {
+    EXPECT_TRUE(buffer.push(make_chunk(i), t0));
+    bool restarted = true;
+    EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+    EXPECT_FALSE(restarted);
+    EXPECT_EQ(out.sequence, i);
+    EXPECT_EQ(out.data.size(), 1600u);
+  }
+  EXPECT_EQ(buffer.pop(out, t0), -1);
+}
+
+TEST(JitterBuffer, Reorders) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  buffer.push(make_chunk(0), t0);
+  EXPECT_EQ(buffer.pop(out, t0), 0);
+
+  buffer.push(make_chunk(2), t0);
+  EXPECT_EQ(buffer.pop(out, t0), -1);
+  buffer.push(make_chunk(1), t0);
+  EXPECT_EQ(buffer.pop(out, t0), 0);
+  EXPECT_EQ(out.sequence, 1u);
+  EXPECT_EQ(buffer.pop(out, t0), 0);
+  EXPECT_EQ(out.sequence, 2u);
+  EXPECT_EQ(buffer.lost_chunks(), 0u);
+}
+
+TEST(JitterBuffer, DeclaresLostAfterLatency) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  buffer.push(make_chunk(0), t0);
+  buffer.pop(out, t0);
+
+  buffer.push(make_chunk(3), t0);
+  EXPECT_EQ(buffer.pop(out, t0 + 50ms), -1);
+  EXPECT_EQ(buffer.pop(out, t0 + 100ms), 2);
+  EXPECT_EQ(out.sequence, 3u);
+  EXPECT_EQ(buffer.lost_chunks(), 2u);
+
+  // The lost chunks can't be played out anymore
+  EXPECT_FALSE(buffer.push(make_chunk(1), t0 + 150ms));
+  EXPECT_EQ(buffer.late_chunks(), 1u);
+}
+
+TEST(JitterBuffer, DropsDuplicates) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  buffer.push(make_chunk(0), t0);
+  buffer.pop(out, t0);
+  EXPECT_FALSE(buffer.push(make_chunk(0), t0));
+  buffer.push(make_chunk(2), t0);
+  EXPECT_FALSE(buffer.push(make_chunk(2), t0));
+}
+
+TEST(JitterBuffer, Pass) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  EXPECT_TRUE(buffer.pass(0, t0));
+  EXPECT_TRUE(buffer.pass(1, t0 + 100ms));
+  // Out of order, has to go through the buffer
+  EXPECT_FALSE(buffer.pass(3, t0 + 300ms));
+  buffer.push(make_chunk(3), t0);
+  EXPECT_FALSE(buffer.pass(2, t0 + 200ms));
+  buffer.push(make_chunk(2), t0);
+  EXPECT_EQ(buffer.pop(out, t0), 0);
+  EXPECT_EQ(out.sequence, 2u);
+  EXPECT_EQ(buffer.pop(out, t0), 0);
+  EXPECT_TRUE(buffer.pass(4, t0 + 400ms));
+}
+
+TEST(JitterBuffer, RestartFarBehind) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  bool restarted;
+  for (std::uint64_t i = 1000; i < 1003; ++i) {
+    buffer.push(make_chunk(i), t0);
+    buffer.pop(out, t0, &restarted);
+  }
+  // Captured before the last chunk, but too far back to be late
+  buffer.push(make_chunk(5, t0), t0);
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_TRUE(restarted);
+  EXPECT_EQ(out.sequence, 5u);
+  buffer.push(make_chunk(6, t0 + 100ms), t0);
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_FALSE(restarted);
+}
+
+TEST(JitterBuffer, EarlyRestart) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  bool restarted;
+  for (std::uint64_t i = 0; i < 10; ++i) {
+    buffer.push(make_chunk(i), t0);
+    buffer.pop(out, t0, &restarted);
+  }
+  // Within max_chunks of the old stream, but captured after its last chunk
+  const auto restart = t0 + 1500ms;
+  EXPECT_TRUE(buffer.push(make_chunk(0, restart), t0));
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_TRUE(restarted);
+  EXPECT_EQ(out.stamp, restart);
+  for (std::uint64_t i = 1; i < 12; ++i) {
+    EXPECT_TRUE(buffer.push(make_chunk(i, restart + i * 100ms), t0));
+    EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+    EXPECT_FALSE(restarted);
+    EXPECT_EQ(out.sequence, i);
+  }
+  EXPECT_EQ(buffer.late_chunks(), 0u);
+
+  // A genuinely late chunk of the new stream is still dropped
+  EXPECT_FALSE(buffer.push(make_chunk(3, restart + 300ms), t0));
+  EXPECT_EQ(buffer.late_chunks(), 1u);
+}
+
+TEST(JitterBuffer, RestartOnStampJump) {
+  JitterBuffer buffer(100ms, 64, 2s);
+  JitterBuffer::Chunk out;
+  bool restarted;
+  EXPECT_TRUE(buffer.pass(0, t0));
+  EXPECT_TRUE(buffer.pass(1, t0 + 100ms));
+
+  // Next in sequence but far ahead
+  EXPECT_FALSE(buffer.pass(2, t0 + 10s));
+  buffer.push(make_chunk(2, t0 + 10s), t0);
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_TRUE(restarted);
+  EXPECT_TRUE(buffer.pass(3, t0 + 10s + 100ms));
+
+  // Backwards
+  EXPECT_FALSE(buffer.pass(4, t0));
+  buffer.push(make_chunk(4, t0), t0);
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_TRUE(restarted);
+  EXPECT_EQ(out.stamp, t0);
+}
+
+TEST(JitterBuffer, RestartDropsPending) {
+  JitterBuffer buffer(100ms);
+  JitterBuffer::Chunk out;
+  bool restarted;
+  buffer.push(make_chunk(10), t0);
+  buffer.pop(out, t0);
+  buffer.push(make_chunk(12), t0);
+  buffer.push(make_chunk(13), t0);
+  EXPECT_EQ(buffer.size(), 2u);
+
+  buffer.push(make_chunk(0, t0 + 5s), t0);
+  EXPECT_EQ(buffer.size(), 1u);
+  EXPECT_EQ(buffer.lost_chunks(), 2u);
+  EXPECT_EQ(buffer.pop(out, t0, &restarted), 0);
+  EXPECT_TRUE(restarted);
+  EXPECT_EQ(out.sequence, 0u);
+}